@@ -10,21 +10,23 @@
 
 if (!is_void(plug_in)) plug_in, "yorz";
 
-func png2(name)
+func png2(name, fast=)
 /* DOCUMENT png2, name
      writes the picture in the current graphics window to the png file
      NAME, or to NAME+".png" is NAME does not end in ".png".
+     With fast=1, trade file size for speed as for png_write.
    SEE ALSO: png, jpeg, pdf, eps, hcps
  */
 {
   if (strpart(name,-3:0)!=".png") name+= ".png";
-  png_write, name, rgb_read();
+  png_write, name, rgb_read(), fast=fast;
   return name;
 }
 
-func png_read(filename, &depth, &nfo, type=, quiet=)
+func png_read(filename, &depth, &nfo, subset, stride, type=, quiet=)
 /* DOCUMENT image = png_read(filename)
  *       or image = png_read(filename, depth, nfo)
+ *       or image = png_read(filename, depth, nfo, subset, stride)
  *
  * Read png file FILENAME.  The returned IMAGE is either an array
  * of char or short, unless type= is specified (see below).
@@ -68,16 +70,47 @@ func png_read(filename, &depth, &nfo, type=, quiet=)
  * according to the information in pCAL, or is a no-op if pCAL does
  * not exist.
  *
- * SEE ALSO: png_write, png_scale
+ * FILENAME may also be a char array containing the png data itself,
+ * as returned by png_encode; see png_decode.
+ *
+ * In the third form, SUBSET is [i0,i1,j0,j1] and STRIDE is [di,dj]
+ * (or a scalar for both), and the returned image is the subset
+ * full_image(..,i0:i1:di,j0:j1:dj) of the full image, as for jpeg_read.
+ * As for an index range, i1 or j1 <= 0 counts from the last column or
+ * row.  Either SUBSET or STRIDE may be nil.  Only the kept columns are
+ * stored, and rows past j1 are not decoded at all (unless the file is
+ * interlaced), so a strip or preview costs a fraction of a full read.
+ * When decoding stops early, chunks after the image data (sometimes
+ * tEXt or tIME) are not seen.
+ *
+ * SEE ALSO: png_write, png_scale, png_decode, png_info
  */
 {
   dnwh = array(long, 8);
   nfo = array(pointer, 9);
   image = &[];
   emsg = string(0);
-  rslt = _png_read(filename, dnwh, nfo, image, emsg);
+  roi = [];
+  if (!is_void(subset) || !is_void(stride)) {
+    roi = [1, 0, 1, 0, 1, 1];
+    if (!is_void(subset)) {
+      if (numberof(subset)!=4 || structof(subset+0)!=long)
+        error, "png_read subset must be [i0,i1,j0,j1]";
+      roi(1:4) = subset;
+    }
+    if (!is_void(stride)) {
+      if (numberof(stride)<1 || numberof(stride)>2 ||
+          structof(stride+0)!=long || anyof(stride<1))
+        error, "png_read stride must be [di,dj] or scalar, positive";
+      roi(5:6) = stride;
+    }
+  }
+  inmem = (structof(filename) == char);
+  if (inmem) rslt = _png_decode(filename, dnwh, nfo, image, emsg, roi);
+  else rslt = _png_read(filename, dnwh, nfo, image, emsg, roi);
   if (rslt) {
-    if (rslt == 1) error, "unable to open "+filename;
+    if (rslt == 1) error, (inmem? "png data too short" :
+                           "unable to open "+filename);
     else if (rslt == 2) error, "PNG ERROR: png_create_read_struct_2 failed";
     error, "PNG ERROR: "+emsg;
   }
@@ -90,8 +123,45 @@ func png_read(filename, &depth, &nfo, type=, quiet=)
   return image;
 }
 
+func png_info(filename, &depth, &dims, quiet=)
+/* DOCUMENT nfo = png_info(filename)
+ *       or nfo = png_info(filename, depth, dims)
+ *
+ * Return the NFO pointer array for png file FILENAME, exactly as
+ * png_read would set it, without decoding or allocating the image.
+ * If present, DEPTH and DIMS must be simple variable references.
+ * DEPTH is set as for png_read, and DIMS to dimsof(image) for the
+ * image png_read would return, [2,width,height] for gray or
+ * pseudocolor images, [3,nchan,width,height] otherwise.
+ *
+ * Only the chunks before the image data are read, which is where
+ * png_write puts all of the NFO information, but other programs may
+ * put tEXt or tIME chunks after the image data.
+ *
+ * SEE ALSO: png_read
+ */
+{
+  dnwh = array(long, 8);
+  nfo = array(pointer, 9);
+  emsg = string(0);
+  rslt = _png_info(filename, dnwh, nfo, emsg);
+  if (rslt) {
+    if (rslt == 1) error, "unable to open "+filename;
+    else if (rslt == 2) error, "PNG ERROR: png_create_read_struct_2 failed";
+    error, "PNG ERROR: "+emsg;
+  }
+  if (dnwh(8) && !quiet) {
+    write, format="PNG %ld warnings: %s\n", dnwh(8), emsg;
+  }
+  depth = dnwh(1);
+  if (dnwh(2) > 1) dims = [3, dnwh(2), dnwh(3), dnwh(4)];
+  else dims = [2, dnwh(3), dnwh(4)];
+  return nfo;
+}
+
 func png_write(filename, image, depth, nfo, palette=, alpha=, bkgd=,
-               pcal=, pcals=, scal=, phys=, text=, time=, trns=, quiet=)
+               pcal=, pcals=, scal=, phys=, text=, time=, trns=, quiet=,
+               level=, filter=, strategy=, fast=)
 /* DOCUMENT png_write, filename, image
  *       or png_write, filename, image, depth, nfo
  *
@@ -120,20 +190,71 @@ func png_write(filename, image, depth, nfo, palette=, alpha=, bkgd=,
  * When both NFO and keywords are supplied, the keywords override any
  * corresponding value in nfo.
  *
+ * Four more keywords control compression speed and file size:
+ *   level=0-9  zlib compression level (default 6)
+ *   strategy="default", "filtered", "huffman", "rle", or "fixed"
+ *     as for z_deflate (default "filtered" when rows are filtered)
+ *   filter="none", "sub", "up", "avg", "paeth", or an array of these
+ *     row filters for libpng to choose among, or "all" (the default)
+ *   fast=1  preset for quick diagnostic dumps, equivalent to
+ *     level=1, filter="sub", strategy="rle", which is typically
+ *     several times faster than the default, at some cost in size
+ * Explicit level=, filter=, or strategy= override the fast=1 preset.
+ * For archival files, level=9 gives the smallest output.
+ *
+ * If FILENAME is nil, png_write returns the png file contents as a
+ * char array instead of writing a file; see png_encode.
+ *
  * If IMAGE has a data type other than short or char, a default pCAL
  * will be supplied if it is a simple grayscale (2D) image.  If DEPTH
  * is not supplied, it defaults to 8 if IMAGE is type char and/or if
  * a palette is supplied, or to 16 otherwise.
  *
- * SEE ALSO: png_read, png_map
+ * SEE ALSO: png_read, png_map, png_encode
  */
 {
   /* eventually, do conversion and even select pcal automatically */
   if (structof(image(1)+0) != long)
     error, "image must be converted to integer data type";
+  istruct = structof(image);
+  dnwh = _png_setup(dimsof(image), istruct, depth, nfo, palette, alpha, bkgd,
+                    pcal, pcals, scal, phys, text, time, trns,
+                    level, filter, strategy, fast);
 
-  dnwh = array(long, 8);
-  dims = dimsof(image);
+  /* eventually, this should pay attention to pcal */
+  if (depth > 8) {
+    if (istruct != short) image = short(image);
+  } else {
+    if (istruct != char) image = char(image);
+  }
+
+  emsg = string(0);
+  inmem = is_void(filename);
+  if (inmem) {
+    bytes = array(pointer, 1);
+    rslt = _png_encode(dnwh, nfo, &image, emsg, bytes);
+  } else {
+    rslt = _png_write(filename, dnwh, nfo, &image, emsg);
+  }
+  if (rslt) {
+    if (rslt == 1) error, (inmem? "bad inputs to png_encode" :
+                           "bad inputs or unable to create "+filename);
+    else if (rslt == 2) error, "PNG ERROR: png_create_write_struct_2 failed";
+    error, "PNG ERROR: "+emsg;
+  }
+  if (dnwh(8) && !quiet) {
+    write, format="PNG %ld warnings: %s\n", dnwh(8), emsg;
+  }
+  if (inmem) return *bytes(1);
+}
+
+func _png_setup(dims, istruct, &depth, &nfo, palette, alpha, bkgd,
+                pcal, pcals, scal, phys, text, time, trns,
+                level, filter, strategy, fast)
+{
+  /* check png_write image dimensions, DEPTH, NFO, and keywords
+   * return dnwh array, and set DEPTH and NFO for _png_write */
+  dnwh = array(long, 11);
   nchan = (dims(1)==2);
   if (dims(1)==3) nchan = dims(2);
   if (nchan<1 || nchan>4)
@@ -179,7 +300,6 @@ func png_write(filename, image, depth, nfo, palette=, alpha=, bkgd=,
     p = double(pcal(5:8));
   }
 
-  istruct = structof(image);
   if (!depth) {
     if (dep) depth = (istruct==char)? min(dep,8) : dep;
     else if (istruct==char || pseudo) depth = 8;
@@ -187,13 +307,6 @@ func png_write(filename, image, depth, nfo, palette=, alpha=, bkgd=,
   }
   dnwh(1) = depth;
 
-  /* eventually, this should pay attention to pcal */
-  if (depth > 8) {
-    if (istruct != short) image = short(image);
-  } else {
-    if (istruct != char) image = char(image);
-  }
-
   npal = 0;
   if (!is_void(palette)) {
     if (nchan==2) error, "palette illegal for gray+alpha (2 channel) image";
@@ -293,18 +406,150 @@ func png_write(filename, image, depth, nfo, palette=, alpha=, bkgd=,
   dnwh(5) = npal;
   dnwh(6) = ntxt;
 
+  /* level, strategy, filters, -1 means libpng default */
+  dnwh(9:11) = fast? [1, 3, 2] : -1;
+  if (!is_void(level)) {
+    if (numberof(level)!=1 || structof(level)==string ||
+        level<0 || level>9 || level!=long(level))
+      error, "level= must be 0-9";
+    dnwh(9) = level(1);
+  }
+  if (!is_void(strategy)) {
+    list = [];
+    if (structof(strategy)==string && numberof(strategy)==1)
+      list = where(strategy(1) == _png_snames);
+    if (!numberof(list))
+      error, "strategy= must be default, filtered, huffman, rle, or fixed";
+    dnwh(10) = list(1) - 1;
+  }
+  if (!is_void(filter)) {
+    if (structof(filter) != string) error, "filter= must be string(s)";
+    mask = 0;
+    for (i=1 ; i<=numberof(filter) ; i++) {
+      if (filter(i) == "all") {
+        mask |= 31;
+        continue;
+      }
+      list = where(filter(i) == _png_fnames);
+      if (!numberof(list)) error, "filter= unknown filter "+filter(i);
+      mask |= 1 << (list(1)-1);
+    }
+    dnwh(11) = mask;
+  }
+  return dnwh;
+}
+
+_png_snames = ["default", "filtered", "huffman", "rle", "fixed"];
+_png_fnames = ["none", "sub", "up", "avg", "paeth"];
+
+func png_encode(image, depth, nfo, palette=, alpha=, bkgd=,
+                pcal=, pcals=, scal=, phys=, text=, time=, trns=, quiet=,
+                level=, filter=, strategy=, fast=)
+/* DOCUMENT bytes = png_encode(image)
+ *       or bytes = png_encode(image, depth, nfo)
+ *
+ * Return a char array containing IMAGE in png format, exactly the
+ * bytes png_write would have written to a file.  No file is created.
+ * The arguments and keywords are the same as for png_write.
+ * Use png_decode (or png_read) to recover the image.
+ *
+ * SEE ALSO: png_decode, png_write
+ */
+{
+  return png_write([], image, depth, nfo, palette=palette, alpha=alpha,
+                   bkgd=bkgd, pcal=pcal, pcals=pcals, scal=scal, phys=phys,
+                   text=text, time=time, trns=trns, quiet=quiet,
+                   level=level, filter=filter, strategy=strategy, fast=fast);
+}
+
+func png_decode(bytes, &depth, &nfo, subset, stride, type=, quiet=)
+/* DOCUMENT image = png_decode(bytes)
+ *       or image = png_decode(bytes, depth, nfo)
+ *       or image = png_decode(bytes, depth, nfo, subset, stride)
+ *
+ * Decode the char array BYTES, which holds the contents of a png file,
+ * for example as returned by png_encode.  The arguments, keywords, and
+ * return value are the same as for png_read.  No file is read.
+ *
+ * SEE ALSO: png_encode, png_read
+ */
+{
+  if (structof(bytes) != char) error, "png_decode needs char array input";
+  return png_read(bytes, depth, nfo, subset, stride, type=type, quiet=quiet);
+}
+
+func png_open_write(filename, band, height, depth, nfo, palette=, alpha=,
+                    bkgd=, pcal=, pcals=, scal=, phys=, text=, time=,
+                    trns=, quiet=, level=, filter=, strategy=, fast=)
+/* DOCUMENT w = png_open_write(filename, band, height)
+ *       or w = png_open_write(filename, band, height, depth, nfo)
+ *     then png_write_rows, w, band
+ *          ...
+ *          png_close, w
+ *
+ * Open png file FILENAME for writing an image of HEIGHT rows one band
+ * of rows at a time, so that the whole image need never be in memory.
+ * BAND is a sample band, for example the first band you intend to
+ * write, which determines the number of channels and the width of
+ * the image (and the default DEPTH), exactly as IMAGE does for
+ * png_write.  BAND itself is not written.  The DEPTH, NFO, and
+ * keywords are the same as for png_write; all of the metadata is
+ * written to the file header by png_open_write.
+ *
+ * Each png_write_rows call appends the rows of BAND, which may hold
+ * any number of rows, to the file.  After all HEIGHT rows have been
+ * written, png_close finishes the file.  If W is closed or discarded
+ * before all rows are written, the file is left incomplete.
+ *
+ * SEE ALSO: png_write, png_write_rows, png_close
+ */
+{
+  if (structof(band(1)+0) != long)
+    error, "band must be converted to integer data type";
+  dims = dimsof(band);
+  if (dims(1)<2 || dims(1)>3)
+    error, "band must be 2D gray or 3D [nchan,width,nrows] array";
+  height = long(height);
+  if (height < 1) error, "image height must be positive";
+  dims(0) = height;
+  dnwh = _png_setup(dims, structof(band), depth, nfo, palette, alpha, bkgd,
+                    pcal, pcals, scal, phys, text, time, trns,
+                    level, filter, strategy, fast);
   emsg = string(0);
-  rslt = _png_write(filename, dnwh, nfo, &image, emsg);
-  if (rslt) {
-    if (rslt == 1) error, "bad inputs or unable to create "+filename;
-    else if (rslt == 2) error, "PNG ERROR: png_create_write_struct_2 failed";
+  w = _png_wopen(filename, dnwh, nfo, emsg);
+  if (typeof(w) == "int") {
+    if (w == 1) error, "bad inputs or unable to create "+filename;
+    else if (w == 2) error, "PNG ERROR: png_create_write_struct_2 failed";
     error, "PNG ERROR: "+emsg;
   }
   if (dnwh(8) && !quiet) {
     write, format="PNG %ld warnings: %s\n", dnwh(8), emsg;
   }
+  return w;
 }
 
+extern png_write_rows;
+/* DOCUMENT png_write_rows, w, band
+ *
+ * Append the rows of BAND to the png file opened by png_open_write.
+ * BAND must have the same number of channels and width as the sample
+ * band passed to png_open_write, but may have any number of rows.
+ * BAND is converted to char or short according to the depth one row
+ * at a time, so no full size copy is ever made.
+ *
+ * SEE ALSO: png_open_write, png_close
+ */
+
+extern png_close;
+/* DOCUMENT png_close, w
+ *
+ * Finish the png file opened by png_open_write.  It is an error if
+ * fewer than the declared number of rows have been written with
+ * png_write_rows; the file is then left incomplete.
+ *
+ * SEE ALSO: png_open_write, png_write_rows
+ */
+
 func png_scale(image, nfo, type=)
 /* DOCUMENT image = png_scale(raw_image, nfo, type=type)
  *   scales RAW_IMAGE to type TYPE (char, short, int, long, float, or
@@ -583,3 +828,7 @@ if (is_void(_png_log)) _png_log = log;
 
 extern _png_read;
 extern _png_write;
+extern _png_decode;
+extern _png_info;
+extern _png_encode;
+extern _png_wopen;
@@ -76,7 +76,15 @@ func pngtest(keep=)
        anyof(time!=*nfo(9))];
   if (noneof(x)) write, "OK: test-all.png";
   else { write, "FAILURE: test-all.png:"; x; }
-  if (noneof(x) && !keep) remove, "test-all.png";
+  dims = [];
+  nfo2 = png_info("test-all.png", depth, dims);
+  x2 = [anyof(dims!=dimsof(zb)), depth!=8, anyof(pal!=*nfo2(1)),
+        anyof(alpha!=*nfo2(2)), anyof(bk1!=*nfo2(3)), anyof(pcal!=*nfo2(4)),
+        anyof(pcals!=*nfo2(5)), anyof(scal!=*nfo2(6)), anyof(phys!=*nfo2(7)),
+        anyof(kt!=*nfo2(8)), anyof(time!=*nfo2(9))];
+  if (noneof(x2)) write, "OK: png_info test-all.png";
+  else { write, "FAILURE: png_info test-all.png:"; x2; }
+  if (noneof(x) && noneof(x2) && !keep) remove, "test-all.png";
 
   zb3 = pal(,1+max(zb,48));
   png_write, "test-rgbx.png", zb3, trns=tr3, bkgd=bk3,
@@ -91,6 +99,47 @@ func pngtest(keep=)
   else { write, "FAILURE: test-rgbx.png:"; x; }
   if (noneof(x) && !keep) remove, "test-rgbx.png";
 
+  bytes = png_encode(zb, pcal=pcal, pcals=pcals, text=kt);
+  im = png_decode(bytes, depth, nfo);
+  x = [structof(bytes)!=char, anyof(im!=zb), anyof(pcal!=*nfo(4)),
+       anyof(pcals!=*nfo(5)), anyof(kt!=*nfo(8))];
+  if (noneof(x)) write, "OK: png_encode/png_decode";
+  else { write, "FAILURE: png_encode/png_decode:"; x; }
+
+  png_write, "test-roi.png", zb3;
+  im = png_read("test-roi.png", depth, nfo, [31,-30,101,140], [3,2]);
+  if (x1 = anyof(im!=zb3(,31:-30:3,101:140:2)))
+    write, "FAILURE: test-roi.png (subset)";
+  else write, "OK: test-roi.png";
+  if (!x1 && !keep) remove, "test-roi.png";
+
+  /* png_write never interlaces, so encode this one independently */
+  bytes = pngadam7(zb3);
+  im = png_decode(bytes, depth, nfo);
+  if (x1 = anyof(im!=zb3)) write, "FAILURE: interlaced png (image)";
+  im = png_decode(bytes, depth, nfo, [31,-30,101,140], [3,2]);
+  if (x2 = anyof(im!=zb3(,31:-30:3,101:140:2)))
+    write, "FAILURE: interlaced png (subset)";
+  if (!x1 && !x2) write, "OK: interlaced png";
+
+  w = png_open_write("test-rows.png", zb3(,,1:100), 380, pcal=pcal,
+                     pcals=pcals, text=kt);
+  for (i=1 ; i<=380 ; i+=100) png_write_rows, w, zb3(,,i:min(i+99,380));
+  png_close, w;
+  im = png_read("test-rows.png", depth, nfo);
+  x = [anyof(im!=zb3), anyof(pcal!=*nfo(4)), anyof(pcals!=*nfo(5)),
+       anyof(kt!=*nfo(8))];
+  if (noneof(x)) write, "OK: test-rows.png";
+  else { write, "FAILURE: test-rows.png:"; x; }
+  if (noneof(x) && !keep) remove, "test-rows.png";
+
+  b1 = png_encode(zb3, fast=1);
+  b2 = png_encode(zb3, level=9, filter=["sub","up"], strategy="filtered");
+  x = [anyof(png_decode(b1)!=zb3), anyof(png_decode(b2)!=zb3),
+       numberof(b2)>numberof(b1)];
+  if (noneof(x)) write, "OK: png_encode fast=, level=, filter=";
+  else { write, "FAILURE: png_encode fast=, level=, filter=:"; x; }
+
   zb = short(long(65535.999*(z-min(z))/(max(z)-min(z))));
   png_write, "test-gray16.png", zb;
 
@@ -98,7 +147,10 @@ func pngtest(keep=)
   if (x1 = (anyof(im!=zb) || structof(im)!=short))
     write, "FAILURE: test-gray16.png (image)";
   else write, "OK: test-gray16.png";
-  if (!x1 && !keep) remove, "test-gray16.png";
+  im = png_read("test-gray16.png", depth, nfo, [5,-7,11,300], [4,3]);
+  if (x2 = (anyof(im!=zb(5:-7:4,11:300:3)) || structof(im)!=short))
+    write, "FAILURE: test-gray16.png (subset)";
+  if (!x1 && !x2 && !keep) remove, "test-gray16.png";
 
   zb = short(1023.999*(z-min(z))/(max(z)-min(z)));
   png_write, "test-gray10.png", zb, 10;
@@ -208,6 +260,52 @@ func pngchunk(f, &addr, &type, &crc)
   return [];
 }
 
+/* ------------ independent interlaced png encoder ------------- */
+
+func pngadam7(image)
+/* DOCUMENT bytes = pngadam7(image)
+     return png file contents for the 8-bit gray (WIDTHxHEIGHT) or rgb
+     (3xWIDTHxHEIGHT) char IMAGE, Adam7 interlaced and unfiltered.
+ */
+{
+  require, "zlib.i";
+  dims = dimsof(image);
+  nchan = (dims(1)==3)? 3 : 1;
+  width = dims(-1);
+  height = dims(0);
+  x0 = [0, 4, 0, 2, 0, 1, 0];
+  y0 = [0, 0, 4, 0, 2, 0, 1];
+  dx = [8, 8, 4, 4, 2, 2, 1];
+  dy = [8, 8, 8, 4, 4, 2, 2];
+  raw = [];
+  for (p=1 ; p<=7 ; p++) {
+    if (x0(p)>=width || y0(p)>=height) continue;
+    sub = image(..,x0(p)+1:width:dx(p),y0(p)+1:height:dy(p));
+    nrow = dimsof(sub)(0);
+    rows = array(char, numberof(sub)/nrow, nrow);
+    rows(*) = sub(*);
+    line = array(char, 1+numberof(sub)/nrow, nrow);  /* filter type 0 */
+    line(2:,) = rows;
+    grow, raw, line(*);
+  }
+  ihdr = grow(pngbe4(width), pngbe4(height),
+              char([8, ((nchan==3)? 2 : 0), 0, 0, 1]));
+  return grow(char([137,80,78,71,13,10,26,10]), pngmkchunk("IHDR", ihdr),
+              pngmkchunk("IDAT", z_flush(z_deflate(), raw)),
+              pngmkchunk("IEND", []));
+}
+
+func pngmkchunk(type, data)
+{
+  return grow(pngbe4(numberof(data)), (*pointer(type))(1:4), data,
+              pngbe4(pngcrc(type, data)));
+}
+
+func pngbe4(x)
+{
+  return char((x >> [24, 16, 8, 0]) & 0xff);
+}
+
 pngtable = [];
 
 func pngcrc(type, data)
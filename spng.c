@@ -36,6 +36,7 @@ sp_init(sp_info *info)
   info->keytxt = 0;
   info->itime[0] = info->itime[1] = info->itime[2] =
     info->itime[3] = info->itime[4] = info->itime[5] = 0;
+  info->level = info->strategy = info->filters = -1;
   info->nerrs = info->nwarn = 0;
   info->msg[0] = '\0';
   return info;
@@ -96,6 +97,10 @@ struct spng_id {
   png_infop pi;
   sp_memops *memops;
   sp_info *info;
+  /* memory source or sink, when there is no FILE */
+  unsigned char *mem;
+  unsigned long nmem, imem;
+  long rowbytes;        /* bytes per row in memory when writing */
 };
 
 static void spng_error(png_structp p, png_const_charp msg);
@@ -104,19 +109,82 @@ static void spng_warning(png_structp p, png_const_charp msg);
 static png_voidp spng_malloc(png_structp p, png_size_t nbytes);
 static void spng_free(png_structp p, png_voidp ptr);
 
+static void spng_rdmem(png_structp p, png_bytep data, png_size_t nbytes);
+static void spng_wrmem(png_structp p, png_bytep data, png_size_t nbytes);
+static void spng_flmem(png_structp p);
+
+static int spng_read(FILE *f, const unsigned char *data, unsigned long nbytes,
+                     const long *roi, int noimage,
+                     sp_memops *memops, sp_info *info);
+static int spng_wbegin(spng_id *id, FILE *f, int stream,
+                       sp_memops *memops, sp_info *info);
+static int spng_write(FILE *f, unsigned char **data, unsigned long *nbytes,
+                      sp_memops *memops, sp_info *info);
+
 /*------------------------------------------------------------------------*/
 
 int
 sp_read(const char *filename, sp_memops *memops, sp_info *info)
+{
+  return sp_read_roi(filename, 0, memops, info);
+}
+
+int
+sp_read_mem(const unsigned char *data, unsigned long nbytes,
+            sp_memops *memops, sp_info *info)
+{
+  return sp_read_mem_roi(data, nbytes, 0, memops, info);
+}
+
+int
+sp_read_roi(const char *filename, const long *roi,
+            sp_memops *memops, sp_info *info)
+{
+  FILE *f;
+  int rslt;
+  sp_init(info);
+  f = fopen(filename, "rb");
+  if (!f) return 1;
+  rslt = spng_read(f, 0, 0UL, roi, 0, memops, info);
+  fclose(f);
+  return rslt;
+}
+
+int
+sp_read_info(const char *filename, sp_memops *memops, sp_info *info)
+{
+  FILE *f;
+  int rslt;
+  sp_init(info);
+  f = fopen(filename, "rb");
+  if (!f) return 1;
+  rslt = spng_read(f, 0, 0UL, 0, 1, memops, info);
+  fclose(f);
+  return rslt;
+}
+
+int
+sp_read_mem_roi(const unsigned char *data, unsigned long nbytes,
+                const long *roi, sp_memops *memops, sp_info *info)
+{
+  sp_init(info);
+  if (!data || nbytes<8) return 1;
+  return spng_read(0, data, nbytes, roi, 0, memops, info);
+}
+
+static int
+spng_read(FILE *f, const unsigned char *data, unsigned long nbytes,
+          const long *roi, int noimage, sp_memops *memops, sp_info *info)
 {
   spng_id id;
-  FILE *f = 0;
   png_structp p = 0;
   png_infop pi = 0;
   png_voidp (*spx_malloc)(png_structp p, png_size_t nbytes) = 0;
   void (*spx_free)(png_structp p, png_voidp ptr) = 0;
-  png_bytep *rows = 0;
+  png_bytep *volatile rows = 0;  /* survives longjmp */
+  unsigned char *volatile scratch = 0;
   png_color_8p sbit = 0;
+  int finished = 1;
 
   if (memops && memops->smalloc && memops->sfree) {
     spx_malloc = spng_malloc;
@@ -128,23 +196,25 @@ sp_read(const char *filename, sp_memops *memops, sp_info *info)
   id.pi = 0;
   id.memops = memops;
   id.info = info;
-  sp_init(info);
-
-  f = fopen(filename, "rb");
-  if (!f) return 1;
+  id.mem = (unsigned char *)data;
+  id.nmem = nbytes;
+  id.imem = 0;
 
   id.p = p = png_create_read_struct_2(PNG_LIBPNG_VER_STRING,
                                       &id, spng_error, spng_warning,
                                       &id, spx_malloc, spx_free);
-  if (!p) { fclose(f); return 2; }
+  if (!p) return 2;
 
   if (setjmp(png_jmpbuf(p))) {
     if (rows) {
       if (!memops || !memops->sfree) free(rows);
       else memops->sfree(rows);
     }
+    if (scratch) {
+      if (!memops || !memops->sfree) free(scratch);
+      else memops->sfree(scratch);
+    }
     png_destroy_read_struct(&p, &pi, 0);
-    fclose(f);
     sp_free(info, memops);
     return 3;
   }
@@ -152,7 +222,8 @@ sp_read(const char *filename, sp_memops *memops, sp_info *info)
   id.pi = pi = png_create_info_struct(p);
   if (!pi) spng_error(p, "png_create_info_struct failed");
 
-  png_init_io(p, f);
+  if (f) png_init_io(p, f);
+  else png_set_read_fn(p, &id, spng_rdmem);
   png_read_info(p, pi);
 
   {
@@ -296,8 +367,14 @@ sp_read(const char *filename, sp_memops *memops, sp_info *info)
     }
   }
 
-  {
+  if (noimage) {
+    /* header probe, stop before first IDAT chunk */
+    finished = 0;
+  } else {
     long i, rowbytes = info->nchan*info->width, nrows = info->height;
+    long width = info->width, nx = info->width, ny = info->height;
+    long i0 = 1, i1 = nx, j0 = 1, j1 = ny, di = 1, dj = 1;
+    int interlaced = 0;
     unsigned char *image;
     if (info->depth < 8) {
       png_set_packing(p);  /* one pixel per byte */
@@ -308,26 +385,78 @@ sp_read(const char *filename, sp_memops *memops, sp_info *info)
       rowbytes += rowbytes;
     }
     if (sbit) png_set_shift(p, sbit);
+    if (png_set_interlace_handling(p) > 1) interlaced = 1;
     png_read_update_info(p, pi);
     if (png_get_rowbytes(p, pi) != rowbytes)
       spng_error(p, "unexpected number of bytes in image rows");
-    if (!memops || !memops->imalloc) image = malloc(rowbytes*nrows);
-    else image = memops->imalloc(info->depth>8? 16 : 8, info->nchan,
-                                 info->width, info->height);
+
+    if (roi) {
+      /* roi[6] = [i0,i1,j0,j1,di,dj], 1-origin inclusive, i1 or j1<=0
+       * relative to last column or row, di, dj strides */
+      i0 = roi[0];
+      i1 = (roi[1]>0)? roi[1] : info->width+roi[1];
+      j0 = roi[2];
+      j1 = (roi[3]>0)? roi[3] : info->height+roi[3];
+      di = (roi[4]>1)? roi[4] : 1;
+      dj = (roi[5]>1)? roi[5] : 1;
+      if (i0<1 || i0>i1 || i1>info->width ||
+          j0<1 || j0>j1 || j1>info->height)
+        spng_error(p, "png_read subset outside image");
+      nx = (i1-i0)/di + 1;
+      ny = (j1-j0)/dj + 1;
+    }
+
+    if (!memops || !memops->imalloc) image = malloc(nx*ny*(rowbytes/width));
+    else image = memops->imalloc(info->depth>8? 16 : 8, info->nchan, nx, ny);
     if (!image) spng_error(p, "spng failed to malloc image");
     if (info->depth>8) info->simage = (unsigned short *)image;
     else info->cimage = image;
-    if (!memops || !memops->smalloc) rows = malloc(sizeof(png_bytep)*nrows);
-    else rows = memops->smalloc(sizeof(png_bytep)*nrows);
-    if (!rows) spng_error(p, "spng failed to malloc rows");
-    for (i=0 ; i<nrows ; i++, image+=rowbytes) rows[i] = (png_bytep)image;
-    png_read_image(p, rows);
-    if (!memops || !memops->sfree) free(rows);
-    else memops->sfree(rows);
-    rows = 0;
+
+    if (!roi || interlaced) {
+      /* interlaced subset needs whole image, decode it into scratch */
+      unsigned char *full = image;
+      if (roi) {
+        if (!memops || !memops->smalloc) scratch = malloc(rowbytes*nrows);
+        else scratch = memops->smalloc(rowbytes*nrows);
+        if (!scratch) spng_error(p, "spng failed to malloc scratch image");
+        full = scratch;
+      }
+      if (!memops || !memops->smalloc) rows = malloc(sizeof(png_bytep)*nrows);
+      else rows = memops->smalloc(sizeof(png_bytep)*nrows);
+      if (!rows) spng_error(p, "spng failed to malloc rows");
+      for (i=0 ; i<nrows ; i++, full+=rowbytes) rows[i] = (png_bytep)full;
+      png_read_image(p, rows);
+      if (!memops || !memops->sfree) free(rows);
+      else memops->sfree(rows);
+      rows = 0;
+    } else {
+      /* decode one row at a time, quitting after row j1 */
+      if (!memops || !memops->smalloc) scratch = malloc(rowbytes);
+      else scratch = memops->smalloc(rowbytes);
+      if (!scratch) spng_error(p, "spng failed to malloc scratch row");
+    }
+
+    if (roi) {
+      long pix = rowbytes / width, j, k;
+      unsigned char *row;
+      for (j=1 ; j<=j1 ; j++) {
+        if (interlaced) row = scratch + (j-1)*rowbytes;
+        else png_read_row(p, row = scratch, 0);
+        if (j<j0 || (j-j0)%dj) continue;
+        for (k=0 ; k<nx ; k++, image+=pix)
+          memcpy(image, row+(i0-1+k*di)*pix, pix);
+      }
+      if (!memops || !memops->sfree) free(scratch);
+      else memops->sfree(scratch);
+      scratch = 0;
+      info->width = nx;
+      info->height = ny;
+      finished = interlaced || (j1 == nrows);
+    }
   }
 
-  png_read_end(p, pi);
+  /* chunks after the image data are lost if decoding stopped early */
+  if (finished) png_read_end(p, pi);
 
   {
     png_timep time;
@@ -374,7 +503,6 @@ sp_read(const char *filename, sp_memops *memops, sp_info *info)
   }
 
   png_destroy_read_struct(&p, &pi, 0);
-  fclose(f);
   return 0;
 }
 
@@ -383,8 +511,27 @@ sp_read(const char *filename, sp_memops *memops, sp_info *info)
 int
 sp_write(const char *filename, sp_memops *memops, sp_info *info)
 {
-  spng_id id;
-  FILE *f = 0;
+  FILE *f = fopen(filename, "wb");
+  int rslt;
+  if (!f) return 1;
+  rslt = spng_write(f, 0, 0, memops, info);
+  fclose(f);
+  return rslt;
+}
+
+int
+sp_write_mem(unsigned char **data, unsigned long *nbytes,
+             sp_memops *memops, sp_info *info)
+{
+  *data = 0;
+  *nbytes = 0;
+  return spng_write(0, data, nbytes, memops, info);
+}
+
+static int
+spng_wbegin(spng_id *id, FILE *f, int stream,
+            sp_memops *memops, sp_info *info)
+{
   png_structp p = 0;
   png_infop pi = 0;
   int ctype, nchan = info->nchan, depth = info->depth;
@@ -392,7 +539,6 @@ sp_write(const char *filename, sp_memops *memops, sp_info *info)
   int npal = info->palette? info->npal : 0;
   png_voidp (*spx_malloc)(png_structp p, png_size_t nbytes) = 0;
   void (*spx_free)(png_structp p, png_voidp ptr) = 0;
-  png_bytep *rows = 0;
   png_color_8 sbit;
   int do_sbit = 0;
 
@@ -409,7 +555,8 @@ sp_write(const char *filename, sp_memops *memops, sp_info *info)
   }
   /* cannot store images with alpha channel at depth 1, 2, or 4 */
   if ((nchan==2 || nchan>3) && depth<8) depth = 8;
-  if ((depth>8)? (info->simage==0) : (info->cimage==0)) depth = 0;
+  if (!stream && ((depth>8)? (info->simage==0) : (info->cimage==0)))
+    depth = 0;
 
   if (memops && memops->smalloc && memops->sfree) {
     spx_malloc = spng_malloc;
@@ -418,36 +565,38 @@ sp_write(const char *filename, sp_memops *memops, sp_info *info)
   info->nerrs = info->nwarn = 0;
   info->msg[0] = '\0';
 
-  id.id = &id;
-  id.p = 0;
-  id.pi = 0;
-  id.memops = memops;
-  id.info = info;
+  id->id = id;
+  id->p = 0;
+  id->pi = 0;
+  id->memops = memops;
+  id->info = info;
+  id->mem = 0;
+  id->nmem = id->imem = 0;
 
-  f = fopen(filename, "wb");
-  if (!f || nchan<1 || nchan>4 || width<1 || height<1 ||
+  if (nchan<1 || nchan>4 || width<1 || height<1 ||
       depth<1 || depth>16 || (nchan!=1 && ((depth-1)&depth)) ||
       npal<0 || npal>PNG_MAX_PALETTE_LENGTH) return 1;
 
-  id.p = p = png_create_write_struct_2(PNG_LIBPNG_VER_STRING,
-                                       &id, spng_error, spng_warning,
-                                       &id, spx_malloc, spx_free);
-  if (!p) { fclose(f); return 2; }
+  id->p = p = png_create_write_struct_2(PNG_LIBPNG_VER_STRING,
+                                        id, spng_error, spng_warning,
+                                        id, spx_malloc, spx_free);
+  if (!p) return 2;
 
   if (setjmp(png_jmpbuf(p))) {
-    if (rows) {
-      if (!memops || !memops->sfree) free(rows);
-      else memops->sfree(rows);
+    if (id->mem) {
+      if (!memops || !memops->sfree) free(id->mem);
+      else memops->sfree(id->mem);
+      id->mem = 0;
     }
-    png_destroy_read_struct(&p, &pi, 0);
-    fclose(f);
+    png_destroy_write_struct(&id->p, &id->pi);
     return 3;
   }
 
-  id.pi = pi = png_create_info_struct(p);
+  id->pi = pi = png_create_info_struct(p);
   if (!pi) spng_error(p, "png_create_info_struct failed");
 
-  png_init_io(p, f);
+  if (f) png_init_io(p, f);
+  else png_set_write_fn(p, id, spng_wrmem, spng_flmem);
 
   if ((depth-1) & depth) {
     do_sbit = !npal;
@@ -460,6 +609,20 @@ sp_write(const char *filename, sp_memops *memops, sp_info *info)
                PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
                PNG_FILTER_TYPE_DEFAULT);
 
+  if (info->level>=0 && info->level<=9)
+    png_set_compression_level(p, info->level);
+  if (info->strategy>=0 && info->strategy<=4)
+    png_set_compression_strategy(p, info->strategy);
+  if (info->filters > 0) {
+    int mask = 0;
+    if (info->filters & SP_FILTER_NONE) mask |= PNG_FILTER_NONE;
+    if (info->filters & SP_FILTER_SUB) mask |= PNG_FILTER_SUB;
+    if (info->filters & SP_FILTER_UP) mask |= PNG_FILTER_UP;
+    if (info->filters & SP_FILTER_AVG) mask |= PNG_FILTER_AVG;
+    if (info->filters & SP_FILTER_PAETH) mask |= PNG_FILTER_PAETH;
+    if (mask) png_set_filter(p, PNG_FILTER_TYPE_BASE, mask);
+  }
+
   if (npal > 0) {
     png_color ppal[PNG_MAX_PALETTE_LENGTH];
     int i;
@@ -602,34 +765,145 @@ sp_write(const char *filename, sp_memops *memops, sp_info *info)
 
   png_write_info(p, pi);
 
+  /* set transformations from memory rows to png rows */
+  id->rowbytes = nchan*width;
+  if (depth < 8) png_set_packing(p);  /* one pixel per byte */
+  if (depth > 8) {
+    short endian = 1;
+    char *little_endian = (char *)&endian;
+    if (little_endian[0]) png_set_swap(p);
+    id->rowbytes += id->rowbytes;
+  }
+  if (do_sbit) png_set_shift(p, &sbit);
+  return 0;
+}
+
+static int
+spng_write(FILE *f, unsigned char **data, unsigned long *nbytes,
+           sp_memops *memops, sp_info *info)
+{
+  spng_id id;
+  png_bytep *volatile rows = 0;  /* survives longjmp */
+  int rslt = spng_wbegin(&id, f, 0, memops, info);
+  if (rslt) return rslt;
+
+  if (setjmp(png_jmpbuf(id.p))) {
+    if (rows) {
+      if (!memops || !memops->sfree) free(rows);
+      else memops->sfree(rows);
+    }
+    if (id.mem) {
+      if (!memops || !memops->sfree) free(id.mem);
+      else memops->sfree(id.mem);
+    }
+    png_destroy_write_struct(&id.p, &id.pi);
+    return 3;
+  }
+
   {
-    long i, rowbytes = nchan*width, nrows = height;
+    long i, rowbytes = id.rowbytes, nrows = info->height;
     unsigned char *image = info->cimage;
-    if (depth < 8) png_set_packing(p);  /* one pixel per byte */
-    if (depth > 8) {
-      short endian = 1;
-      char *little_endian = (char *)&endian;
-      if (little_endian[0]) png_set_swap(p);
-      rowbytes += rowbytes;
-      image = (unsigned char *)info->simage;
-    }
-    if (do_sbit) png_set_shift(p, &sbit);
+    if (info->depth > 8) image = (unsigned char *)info->simage;
     if (!memops || !memops->smalloc) rows = malloc(sizeof(png_bytep)*nrows);
     else rows = memops->smalloc(sizeof(png_bytep)*nrows);
-    if (!rows) spng_error(p, "spng failed to malloc rows");
+    if (!rows) spng_error(id.p, "spng failed to malloc rows");
     for (i=0 ; i<nrows ; i++, image+=rowbytes) rows[i] = (png_bytep)image;
-    png_write_image(p, rows);
+    png_write_image(id.p, rows);
     if (!memops || !memops->sfree) free(rows);
     else memops->sfree(rows);
     rows = 0;
   }
 
-  png_write_end(p, pi);
-  png_destroy_write_struct(&p, &pi);
-  fclose(f);
+  png_write_end(id.p, id.pi);
+  png_destroy_write_struct(&id.p, &id.pi);
+  if (!f) {
+    *data = id.mem;
+    *nbytes = id.imem;
+  }
+  return 0;
+}
+
+/*------------------------------------------------------------------------*/
+
+struct sp_writer {
+  spng_id id;
+  FILE *f;
+  long irow, nrows;
+};
+
+sp_writer *
+sp_write_open(const char *filename, sp_memops *memops, sp_info *info,
+              int *rslt)
+{
+  sp_writer *w;
+  FILE *f = fopen(filename, "wb");
+  if (!f) {
+    *rslt = 1;
+    return 0;
+  }
+  if (!memops || !memops->smalloc) w = malloc(sizeof(sp_writer));
+  else w = memops->smalloc(sizeof(sp_writer));
+  if (!w) {
+    fclose(f);
+    *rslt = 2;
+    return 0;
+  }
+  *rslt = spng_wbegin(&w->id, f, 1, memops, info);
+  if (*rslt) {
+    fclose(f);
+    if (!memops || !memops->sfree) free(w);
+    else memops->sfree(w);
+    return 0;
+  }
+  w->f = f;
+  w->irow = 0;
+  w->nrows = info->height;
+  return w;
+}
+
+int
+sp_write_rows(sp_writer *w, const void *image, long nrows)
+{
+  const unsigned char *row = image;
+  if (!w->id.p) return 3;
+  if (nrows<0 || nrows>w->nrows-w->irow) return 1;
+  if (setjmp(png_jmpbuf(w->id.p))) {
+    png_destroy_write_struct(&w->id.p, &w->id.pi);
+    return 3;
+  }
+  for ( ; nrows>0 ; nrows--, row+=w->id.rowbytes, w->irow++)
+    png_write_row(w->id.p, (png_bytep)row);
   return 0;
 }
 
+long
+sp_write_count(sp_writer *w)
+{
+  return w->irow;
+}
+
+int
+sp_write_close(sp_writer *w)
+{
+  sp_memops *memops = w->id.memops;
+  int rslt = 3;
+  if (w->id.p) {
+    if (w->irow < w->nrows) {
+      rslt = 1;  /* abandon incomplete image */
+    } else if (setjmp(png_jmpbuf(w->id.p))) {
+      rslt = 3;
+    } else {
+      png_write_end(w->id.p, w->id.pi);
+      rslt = 0;
+    }
+    png_destroy_write_struct(&w->id.p, &w->id.pi);
+  }
+  fclose(w->f);
+  if (!memops || !memops->sfree) free(w);
+  else memops->sfree(w);
+  return rslt;
+}
+
 /*------------------------------------------------------------------------*/
 
 static png_voidp
@@ -654,6 +928,45 @@ spng_free(png_structp p, png_voidp ptr)
   }
 }
 
+static void
+spng_rdmem(png_structp p, png_bytep data, png_size_t nbytes)
+{
+  spng_id *id = png_get_io_ptr(p);
+  if (nbytes > id->nmem-id->imem) spng_error(p, "png data ends prematurely");
+  memcpy(data, id->mem+id->imem, nbytes);
+  id->imem += nbytes;
+}
+
+static void
+spng_wrmem(png_structp p, png_bytep data, png_size_t nbytes)
+{
+  spng_id *id = png_get_io_ptr(p);
+  if (nbytes > id->nmem-id->imem) {
+    /* grow sink geometrically, memops has no realloc */
+    sp_memops *memops = id->memops;
+    unsigned long n = id->nmem? id->nmem : 8192UL;
+    unsigned char *mem;
+    while (n-id->imem < nbytes) n += n;
+    if (!memops || !memops->smalloc) mem = malloc(n);
+    else mem = memops->smalloc(n);
+    if (!mem) spng_error(p, "spng failed to malloc memory sink");
+    if (id->mem) {
+      memcpy(mem, id->mem, id->imem);
+      if (!memops || !memops->sfree) free(id->mem);
+      else memops->sfree(id->mem);
+    }
+    id->mem = mem;
+    id->nmem = n;
+  }
+  memcpy(id->mem+id->imem, data, nbytes);
+  id->imem += nbytes;
+}
+
+static void
+spng_flmem(png_structp p)
+{
+}
+
 static void
 spng_error(png_structp p, png_const_charp msg)
 {
@@ -13,6 +13,7 @@
 
 typedef struct sp_memops sp_memops;
 typedef struct sp_info sp_info;
+typedef struct sp_writer sp_writer;
 
 struct sp_info {
   int depth, nchan, width, height;
@@ -55,6 +56,11 @@ struct sp_info {
   int eqtype, x0, x1, mx;
   double p[4];
 
+  /* zlib compression and row filters, sp_write only, -1 for defaults
+   * level 0-9, strategy 0-4 as zlib Z_DEFAULT_STRATEGY ... Z_FIXED,
+   * filters is a mask of SP_FILTER_ bits (libpng picks per row) */
+  int level, strategy, filters;
+
   int nerrs, nwarn;                 /* error, warning counts */
   char msg[96];                     /* error or first warning message */
 };
@@ -68,6 +74,13 @@ struct sp_info {
 #define SP_METERS 1
 #define SP_RADIANS 2
 
+/* filters bits */
+#define SP_FILTER_NONE 1
+#define SP_FILTER_SUB 2
+#define SP_FILTER_UP 4
+#define SP_FILTER_AVG 8
+#define SP_FILTER_PAETH 16
+
 /* eqtype values */
 #define SP_LINEAR 0
 #define SP_EXP 1
@@ -98,6 +111,37 @@ extern "C" {
 
 extern int sp_read(const char *filename, sp_memops *memops, sp_info *info);
 extern int sp_write(const char *filename, sp_memops *memops, sp_info *info);
+/* in-memory variants: sp_read_mem decodes nbytes of png data,
+ * sp_write_mem returns *data allocated by memops->smalloc (or malloc),
+ * which the caller must free with memops->sfree (or free) */
+extern int sp_read_mem(const unsigned char *data, unsigned long nbytes,
+                       sp_memops *memops, sp_info *info);
+extern int sp_write_mem(unsigned char **data, unsigned long *nbytes,
+                        sp_memops *memops, sp_info *info);
+/* subset variants: roi[6] = [i0,i1,j0,j1,di,dj] reads only columns
+ * i0:i1:di and rows j0:j1:dj (1-origin, inclusive, i1 or j1 <= 0 is
+ * relative to the last column or row), width and height are the subset
+ * dimensions on return.  Unless the file is interlaced, rows past j1
+ * are never decoded, so any chunks after the image data are lost. */
+extern int sp_read_roi(const char *filename, const long *roi,
+                       sp_memops *memops, sp_info *info);
+extern int sp_read_mem_roi(const unsigned char *data, unsigned long nbytes,
+                           const long *roi, sp_memops *memops, sp_info *info);
+/* header probe: like sp_read, but stops at the first image data chunk,
+ * so cimage and simage remain 0 and chunks after the image are not seen */
+extern int sp_read_info(const char *filename, sp_memops *memops,
+                        sp_info *info);
+/* streaming writer: sp_write_open writes the header and all metadata
+ * in info (cimage and simage are ignored), sp_write_rows appends nrows
+ * more rows in cimage or simage layout, sp_write_close finishes the
+ * file, or abandons it if fewer than info->height rows were written
+ * (returning 1).  The info must remain valid until sp_write_close,
+ * which frees the writer in any case. */
+extern sp_writer *sp_write_open(const char *filename, sp_memops *memops,
+                                sp_info *info, int *rslt);
+extern int sp_write_rows(sp_writer *w, const void *image, long nrows);
+extern long sp_write_count(sp_writer *w);
+extern int sp_write_close(sp_writer *w);
 extern void sp_free(sp_info *info, sp_memops *memops);
 extern sp_info *sp_init(sp_info *info);
 
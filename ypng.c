@@ -10,6 +10,9 @@
 
 #include "spng.h"
 
+#include <string.h>
+#include <stdio.h>
+
 #include "pstdlib.h"
 #include "ydata.h"
 #include "yio.h"
@@ -17,6 +20,17 @@
 
 extern void Y__png_read(int nArgs);
 extern void Y__png_write(int nArgs);
+extern void Y__png_decode(int nArgs);
+extern void Y__png_info(int nArgs);
+extern void Y__png_encode(int nArgs);
+extern void Y__png_wopen(int nArgs);
+extern void Y_png_write_rows(int nArgs);
+extern void Y_png_close(int nArgs);
+
+static void ypng_get_info(sp_info *info, long *dnwh, void **infop,
+                          void **imagep);
+static void ypng_set_info(sp_info *info, long *dnwh, void **infop,
+                          void *image);
 
 /* for simage or cimage */
 static void *ypng_imalloc(int depth, int nchan, int width, int height);
@@ -58,107 +72,156 @@ static sp_memops ypng_memops = {
  *   dnwh[5] = info.ntxt;
  *   dnwh[6] = info.alpha!=0
  *   dnwh[7] = info.nwarn;
+ * dnwh[11] when writing, also:
+ *   dnwh[8] = info.level;
+ *   dnwh[9] = info.strategy;
+ *   dnwh[10] = info.filters;
  */
 
 void
 Y__png_read(int nArgs)
 {
   /* do not bother to check arguments here -- done in interpreted code */
-  char *filename = YGetString(sp-4);
-  long *dnwh = YGet_L(sp-3,0,0);
-  void **infop = YGet_P(sp-2,0,0);
-  void **imagep = YGet_P(sp-1,0,0);
-  char **emsg = YGet_Q(sp-0,0,0);
+  char *filename = YGetString(sp-5);
+  long *dnwh = YGet_L(sp-4,0,0);
+  void **infop = YGet_P(sp-3,0,0);
+  void **imagep = YGet_P(sp-2,0,0);
+  char **emsg = YGet_Q(sp-1,0,0);
+  long *roi = YGet_L(sp-0,1,0);
 
   sp_info info;
   char *file = filename? p_native(filename) : 0;
-  int rslt = file? sp_read(file, &ypng_memops, &info) : 0;
+  int rslt = file? sp_read_roi(file, roi, &ypng_memops, &info) : 0;
   if (file) p_free(file);
 
   dnwh[6] = info.nwarn;
   if (rslt || info.nwarn)
     emsg[0] = p_strcpy(info.msg);
-  if (rslt) {
-    PushIntValue(rslt);
+  if (!rslt) ypng_get_info(&info, dnwh, infop, imagep);
+  PushIntValue(rslt);
+}
 
-  } else {
-    int i;
-    imagep[0] = (info.depth>8)? (void *)info.simage : (void *)info.cimage;
-    dnwh[0] = info.depth;
-    dnwh[1] = info.nchan;
-    dnwh[2] = info.width;
-    dnwh[3] = info.height;
-    dnwh[4] = info.npal;
-    dnwh[5] = info.ntxt;
-    dnwh[6] = (info.alpha != 0);
-    dnwh[7] = info.nwarn;
-    infop[0] = info.palette;
-    infop[1] = info.alpha;
-    if ((info.colors & SP_TRNS) && !info.alpha) {
-      Array *a = NewArray(&longStruct, ynew_dim((info.nchan>2)? 3L : 1L, 0));
-      long *trns = a->value.l;
-      infop[1] = trns;
-      trns[0] = info.trns[0];
-      if (info.nchan > 2) {
-        trns[1] = info.trns[1];
-        trns[2] = info.trns[2];
-      }
-    }
-    if (info.colors & SP_BKGD) {
-      Array *a = NewArray(&longStruct, ynew_dim((info.nchan>2)? 3L : 1L, 0));
-      long *bkgd = a->value.l;
-      infop[2] = bkgd;
-      bkgd[0] = info.bkgd[0];
-      if (info.nchan > 2) {
-        bkgd[1] = info.bkgd[1];
-        bkgd[2] = info.bkgd[2];
-      }
-    }
-    if (info.x0 != info.x1) {
-      Array *a = NewArray(&doubleStruct, ynew_dim(8L, 0));
-      double *pcal = a->value.d;
-      infop[3] = pcal;
-      pcal[0] = (double)info.x0;
-      pcal[1] = (double)info.x1;
-      pcal[2] = (double)info.mx;
-      pcal[3] = (double)info.eqtype;
-      pcal[4] = info.p[0];
-      pcal[5] = info.p[1];
-      pcal[6] = info.p[2];
-      pcal[7] = info.p[3];
-      if (info.purpose || info.punit) {
-        Array *a = NewArray(&stringStruct, ynew_dim(2L, 0));
-        char **pcal2 = a->value.q;
-        infop[4] = pcal2;
-        pcal2[0] = info.purpose;
-        pcal2[1] = info.punit;
-      }
-    }
-    if (info.xpix_sz && info.ypix_sz) {
-      Array *a = NewArray(&doubleStruct, ynew_dim(3L, 0));
-      double *scal = a->value.d;
-      infop[5] = scal;
-      scal[0] = info.xpix_sz;
-      scal[1] = info.ypix_sz;
-      scal[2] = (double)info.sunit;
+void
+Y__png_decode(int nArgs)
+{
+  /* do not bother to check arguments here -- done in interpreted code */
+  Dimension *dims = 0;
+  unsigned char *bytes = (unsigned char *)YGet_C(sp-5,0,&dims);
+  long *dnwh = YGet_L(sp-4,0,0);
+  void **infop = YGet_P(sp-3,0,0);
+  void **imagep = YGet_P(sp-2,0,0);
+  char **emsg = YGet_Q(sp-1,0,0);
+  long *roi = YGet_L(sp-0,1,0);
+
+  sp_info info;
+  int rslt = sp_read_mem_roi(bytes, (unsigned long)TotalNumber(dims), roi,
+                             &ypng_memops, &info);
+
+  dnwh[6] = info.nwarn;
+  if (rslt || info.nwarn)
+    emsg[0] = p_strcpy(info.msg);
+  if (!rslt) ypng_get_info(&info, dnwh, infop, imagep);
+  PushIntValue(rslt);
+}
+
+void
+Y__png_info(int nArgs)
+{
+  /* do not bother to check arguments here -- done in interpreted code */
+  char *filename = YGetString(sp-3);
+  long *dnwh = YGet_L(sp-2,0,0);
+  void **infop = YGet_P(sp-1,0,0);
+  char **emsg = YGet_Q(sp-0,0,0);
+  void *image = 0;
+
+  sp_info info;
+  char *file = filename? p_native(filename) : 0;
+  int rslt = file? sp_read_info(file, &ypng_memops, &info) : 1;
+  if (file) p_free(file);
+
+  if (file && (rslt || info.nwarn))
+    emsg[0] = p_strcpy(info.msg);
+  if (!rslt) ypng_get_info(&info, dnwh, infop, &image);
+  PushIntValue(rslt);
+}
+
+static void
+ypng_get_info(sp_info *info, long *dnwh, void **infop, void **imagep)
+{
+  int i;
+  imagep[0] = (info->depth>8)? (void *)info->simage : (void *)info->cimage;
+  dnwh[0] = info->depth;
+  dnwh[1] = info->nchan;
+  dnwh[2] = info->width;
+  dnwh[3] = info->height;
+  dnwh[4] = info->npal;
+  dnwh[5] = info->ntxt;
+  dnwh[6] = (info->alpha != 0);
+  dnwh[7] = info->nwarn;
+  infop[0] = info->palette;
+  infop[1] = info->alpha;
+  if ((info->colors & SP_TRNS) && !info->alpha) {
+    Array *a = NewArray(&longStruct, ynew_dim((info->nchan>2)? 3L : 1L, 0));
+    long *trns = a->value.l;
+    infop[1] = trns;
+    trns[0] = info->trns[0];
+    if (info->nchan > 2) {
+      trns[1] = info->trns[1];
+      trns[2] = info->trns[2];
     }
-    if (info.n_xpix && info.n_ypix) {
-      Array *a = NewArray(&longStruct, ynew_dim(3L, 0));
-      long *phys = a->value.l;
-      infop[6] = phys;
-      phys[0] = info.n_xpix;
-      phys[1] = info.n_ypix;
-      phys[2] = info.per_meter;
+  }
+  if (info->colors & SP_BKGD) {
+    Array *a = NewArray(&longStruct, ynew_dim((info->nchan>2)? 3L : 1L, 0));
+    long *bkgd = a->value.l;
+    infop[2] = bkgd;
+    bkgd[0] = info->bkgd[0];
+    if (info->nchan > 2) {
+      bkgd[1] = info->bkgd[1];
+      bkgd[2] = info->bkgd[2];
     }
-    infop[7] = info.keytxt;
-    if (info.itime[2]) {
-      Array *a = NewArray(&longStruct, ynew_dim(6L, 0));
-      long *time = a->value.l;
-      infop[8] = time;
-      for (i=0 ; i<6 ; i++) time[i] = info.itime[i];
+  }
+  if (info->x0 != info->x1) {
+    Array *a = NewArray(&doubleStruct, ynew_dim(8L, 0));
+    double *pcal = a->value.d;
+    infop[3] = pcal;
+    pcal[0] = (double)info->x0;
+    pcal[1] = (double)info->x1;
+    pcal[2] = (double)info->mx;
+    pcal[3] = (double)info->eqtype;
+    pcal[4] = info->p[0];
+    pcal[5] = info->p[1];
+    pcal[6] = info->p[2];
+    pcal[7] = info->p[3];
+    if (info->purpose || info->punit) {
+      Array *a = NewArray(&stringStruct, ynew_dim(2L, 0));
+      char **pcal2 = a->value.q;
+      infop[4] = pcal2;
+      pcal2[0] = info->purpose;
+      pcal2[1] = info->punit;
     }
-
-    PushIntValue(0);
+  }
+  if (info->xpix_sz && info->ypix_sz) {
+    Array *a = NewArray(&doubleStruct, ynew_dim(3L, 0));
+    double *scal = a->value.d;
+    infop[5] = scal;
+    scal[0] = info->xpix_sz;
+    scal[1] = info->ypix_sz;
+    scal[2] = (double)info->sunit;
+  }
+  if (info->n_xpix && info->n_ypix) {
+    Array *a = NewArray(&longStruct, ynew_dim(3L, 0));
+    long *phys = a->value.l;
+    infop[6] = phys;
+    phys[0] = info->n_xpix;
+    phys[1] = info->n_ypix;
+    phys[2] = info->per_meter;
+  }
+  infop[7] = info->keytxt;
+  if (info->itime[2]) {
+    Array *a = NewArray(&longStruct, ynew_dim(6L, 0));
+    long *time = a->value.l;
+    infop[8] = time;
+    for (i=0 ; i<6 ; i++) time[i] = info->itime[i];
   }
 }
 
@@ -174,6 +237,52 @@ Y__png_write(int nArgs)
   char *file;
   int rslt;
 
+  sp_info info;
+  ypng_set_info(&info, dnwh, infop, image);
+
+  file = p_native(filename);
+  rslt = sp_write(filename, &ypng_memops, &info);
+  p_free(file);
+  dnwh[7] = info.nwarn;
+  if (rslt || info.nwarn)
+    emsg[0] = p_strcpy(info.msg);
+
+  PushIntValue(rslt);
+}
+
+void
+Y__png_encode(int nArgs)
+{
+  /* do not bother to check arguments here -- done in interpreted code */
+  long *dnwh = YGet_L(sp-4,0,0);
+  void **infop = YGet_P(sp-3,0,0);
+  void *image = *YGet_P(sp-2,0,0);
+  char **emsg = YGet_Q(sp-1,0,0);
+  void **bytesp = YGet_P(sp-0,0,0);
+  unsigned char *data;
+  unsigned long nbytes;
+  int rslt;
+
+  sp_info info;
+  ypng_set_info(&info, dnwh, infop, image);
+
+  rslt = sp_write_mem(&data, &nbytes, &ypng_memops, &info);
+  dnwh[7] = info.nwarn;
+  if (rslt || info.nwarn)
+    emsg[0] = p_strcpy(info.msg);
+  if (!rslt) {
+    Array *a = NewArray(&charStruct, ynew_dim((long)nbytes, 0));
+    memcpy(a->value.c, data, nbytes);
+    bytesp[0] = a->value.c;
+  }
+  if (data) ypng_sfree(data);
+
+  PushIntValue(rslt);
+}
+
+static void
+ypng_set_info(sp_info *info, long *dnwh, void **infop, void *image)
+{
   unsigned char *palette = (dnwh[4]>0 && dnwh[4]<=256)? infop[0] : 0;
   unsigned char *alpha = (palette && dnwh[6])? infop[1] : 0;
   unsigned long *trns = dnwh[6]? 0 : infop[1];
@@ -192,72 +301,279 @@ Y__png_write(int nArgs)
   int npal = palette? dnwh[4] : 0;
   int ntxt = dnwh[5];
 
-  sp_info info;
-  sp_init(&info);
-
-  if (depth > 8) info.simage = image;
-  else info.cimage = image;
-
-  info.depth = depth;
-  info.nchan = nchan;
-  info.width = width;
-  info.height = height;
-  info.npal = npal;
-  info.palette = palette;
-  info.alpha = alpha;
+  sp_init(info);
+
+  if (depth > 8) info->simage = image;
+  else info->cimage = image;
+
+  info->depth = depth;
+  info->nchan = nchan;
+  info->width = width;
+  info->height = height;
+  info->npal = npal;
+  info->palette = palette;
+  info->alpha = alpha;
   if (trns) {
-    info.colors |= SP_TRNS;
-    info.trns[0] = trns[0];
-    if (nchan > 2) info.trns[1] = trns[1], info.trns[2] = trns[2];
-    else info.trns[1] = info.trns[2] = trns[0];
+    info->colors |= SP_TRNS;
+    info->trns[0] = trns[0];
+    if (nchan > 2) info->trns[1] = trns[1], info->trns[2] = trns[2];
+    else info->trns[1] = info->trns[2] = trns[0];
   }
   if (bkgd) {
-    info.colors |= SP_BKGD;
-    info.bkgd[0] = bkgd[0];
-    if (nchan > 2) info.bkgd[1] = bkgd[1], info.bkgd[2] = bkgd[2];
-    else info.bkgd[1] = info.bkgd[2] = bkgd[0];
+    info->colors |= SP_BKGD;
+    info->bkgd[0] = bkgd[0];
+    if (nchan > 2) info->bkgd[1] = bkgd[1], info->bkgd[2] = bkgd[2];
+    else info->bkgd[1] = info->bkgd[2] = bkgd[0];
   }
   if (pcal && pcal[0]!=pcal[1]) {
-    info.x0 = (int)pcal[0];
-    info.x1 = (int)pcal[1];
-    info.mx = (int)pcal[2];       /* unused? */
-    info.eqtype = (int)pcal[3];
-    info.p[0] = pcal[4];
-    info.p[1] = pcal[5];
-    info.p[2] = pcal[6];
-    info.p[3] = pcal[7];
+    info->x0 = (int)pcal[0];
+    info->x1 = (int)pcal[1];
+    info->mx = (int)pcal[2];       /* unused? */
+    info->eqtype = (int)pcal[3];
+    info->p[0] = pcal[4];
+    info->p[1] = pcal[5];
+    info->p[2] = pcal[6];
+    info->p[3] = pcal[7];
     if (pcal2) {
-      info.purpose = pcal2[0];
-      info.punit = pcal2[1];
+      info->purpose = pcal2[0];
+      info->punit = pcal2[1];
     }
   }
   if (scal) {
-    info.xpix_sz = scal[0];
-    info.ypix_sz = scal[1];
-    info.sunit = (int)scal[2];
+    info->xpix_sz = scal[0];
+    info->ypix_sz = scal[1];
+    info->sunit = (int)scal[2];
   }
   if (phys) {
-    info.n_xpix = (int)phys[0];
-    info.n_ypix = (int)phys[1];
-    info.per_meter = (phys[2]!=0);
+    info->n_xpix = (int)phys[0];
+    info->n_ypix = (int)phys[1];
+    info->per_meter = (phys[2]!=0);
   }
   if (keytxt && ntxt) {
-    info.ntxt = ntxt;
-    info.keytxt = keytxt;
+    info->ntxt = ntxt;
+    info->keytxt = keytxt;
   }
   if (time) {
     int i;
-    for (i=0 ; i<6 ; i++) info.itime[i] = (short)time[i];
+    for (i=0 ; i<6 ; i++) info->itime[i] = (short)time[i];
   }
+  info->level = dnwh[8];
+  info->strategy = dnwh[9];
+  info->filters = dnwh[10];
+}
 
-  file = p_native(filename);
-  rslt = sp_write(filename, &ypng_memops, &info);
+/*------------------------------------------------------------------------*/
+
+/* png_writer objects (png_open_write), a foreign yorick data type which
+ * writes a png file one band of rows at a time, so that the whole image
+ * never needs to be in memory.  */
+
+typedef struct ypng_writer ypng_writer;
+struct ypng_writer {
+  int references;      /* reference counter */
+  Operations *ops;     /* virtual function table */
+  sp_writer *w;        /* spng writer, 0 after png_close */
+  sp_info info;        /* holds error and warning messages for w */
+  int depth, nchan;
+  long width, height;
+  char *name;          /* file name, p_malloc */
+};
+
+extern void ypng_wfree(void *pw);  /* ******* Use Unref(pw) ******* */
+extern Operations ypng_wops;
+
+extern PromoteOp PromXX;
+extern UnaryOp ToAnyX, NegateX, ComplementX, NotX, TrueX;
+extern BinaryOp AddX, SubtractX, MultiplyX, DivideX, ModuloX, PowerX;
+extern BinaryOp EqualX, NotEqualX, GreaterX, GreaterEQX;
+extern BinaryOp ShiftLX, ShiftRX, OrX, AndX, XorX;
+extern BinaryOp AssignX, MatMultX;
+extern UnaryOp EvalX, SetupX;
+extern MemberOp GetMemberX;
+
+static UnaryOp ypng_wprint;
+
+Operations ypng_wops = {
+  &ypng_wfree, T_OPAQUE, 0, T_STRING, "png_writer",
+  {&PromXX, &PromXX, &PromXX, &PromXX, &PromXX, &PromXX, &PromXX, &PromXX},
+  &ToAnyX, &ToAnyX, &ToAnyX, &ToAnyX, &ToAnyX, &ToAnyX, &ToAnyX,
+  &NegateX, &ComplementX, &NotX, &TrueX,
+  &AddX, &SubtractX, &MultiplyX, &DivideX, &ModuloX, &PowerX,
+  &EqualX, &NotEqualX, &GreaterX, &GreaterEQX,
+  &ShiftLX, &ShiftRX, &OrX, &AndX, &XorX,
+  &AssignX, &EvalX, &SetupX, &GetMemberX, &MatMultX, &ypng_wprint
+};
+
+static ypng_writer *ypng_wget(Symbol *stack, char *fname);
+static void ypng_werror(ypng_writer *pw, int rslt, char *fname);
+
+void
+ypng_wfree(void *pwv)  /* ******* Use Unref(pw) ******* */
+{
+  ypng_writer *pw = pwv;
+  if (!pw) return;
+  if (pw->w) sp_write_close(pw->w);  /* abandons incomplete file */
+  pw->w = 0;
+  p_free(pw->name);
+  p_free(pw);
+}
+
+static void
+ypng_wprint(Operand *op)
+{
+  ypng_writer *pw = op->value;
+  char line[80];
+  ForceNewline();
+  if (!pw->w) {
+    PrintFunc("closed png_writer: ");
+  } else {
+    sprintf(line, "png_writer %ld of %ld rows written: ",
+            sp_write_count(pw->w), pw->height);
+    PrintFunc(line);
+  }
+  PrintFunc(pw->name);
+  ForceNewline();
+}
+
+void
+Y__png_wopen(int nArgs)
+{
+  /* do not bother to check arguments here -- done in interpreted code */
+  char *filename = YGetString(sp-3);
+  long *dnwh = YGet_L(sp-2,0,0);
+  void **infop = YGet_P(sp-1,0,0);
+  char **emsg = YGet_Q(sp-0,0,0);
+  char *file = p_native(filename);
+  int rslt;
+
+  ypng_writer *pw = p_malloc(sizeof(ypng_writer));
+  pw->references = 0;
+  pw->ops = &ypng_wops;
+  ypng_set_info(&pw->info, dnwh, infop, 0);
+  pw->depth = pw->info.depth;
+  pw->nchan = pw->info.nchan;
+  pw->width = pw->info.width;
+  pw->height = pw->info.height;
+  pw->w = sp_write_open(file, &ypng_memops, &pw->info, &rslt);
   p_free(file);
-  dnwh[7] = info.nwarn;
-  if (rslt || info.nwarn)
-    emsg[0] = p_strcpy(info.msg);
+  dnwh[7] = pw->info.nwarn;
+  if (rslt || pw->info.nwarn)
+    emsg[0] = p_strcpy(pw->info.msg);
+  /* metadata now belongs to libpng, drop pointers into yorick arrays */
+  pw->info.palette = pw->info.alpha = 0;
+  pw->info.keytxt = 0;
+  pw->info.ntxt = 0;
+  pw->info.purpose = pw->info.punit = 0;
+  if (rslt) {
+    p_free(pw);
+    PushIntValue(rslt);
+  } else {
+    pw->name = p_strcpy(filename);
+    PushDataBlock(pw);
+  }
+}
 
-  PushIntValue(rslt);
+void
+Y_png_write_rows(int nArgs)
+{
+  ypng_writer *pw;
+  Operand op;
+  long dl[10], rowlen, nrows, i;
+  int nd, rslt, type, wide = 0;
+  void *rows = 0;
+  if (nArgs != 2) YError("png_write_rows takes exactly 2 arguments");
+  pw = ypng_wget(sp-1, "png_write_rows");
+  if (!sp->ops) YError("png_write_rows takes no keywords");
+  sp->ops->FormOperand(sp, &op);
+  type = op.ops->typeID;
+  if (!op.ops->isArray || type<T_CHAR || type>T_LONG)
+    YError("png_write_rows: band must be an integer array");
+  nd = YGet_dims(op.type.dims, dl, 10);
+  if (pw->nchan>1 && (nd<1 || dl[0]!=pw->nchan)) nd = -1;
+  else if (pw->nchan>1) nd--, wide = 1;
+  if (nd<1 || dl[wide]!=pw->width)
+    YError("png_write_rows: band has wrong number of channels or columns");
+  rowlen = pw->nchan * pw->width;
+  nrows = op.type.number / rowlen;
+  if (nrows > pw->height - sp_write_count(pw->w))
+    YError("png_write_rows: band runs past last row of image");
+
+  if (type == ((pw->depth>8)? T_SHORT : T_CHAR)) {
+    rslt = sp_write_rows(pw->w, op.value, nrows);
+  } else {
+    /* convert one row at a time to keep memory bounded by band size */
+    long j, k = 0;
+    rows = p_malloc(rowlen * ((pw->depth>8)? sizeof(short) : 1));
+    for (i=0,rslt=0 ; i<nrows && !rslt ; i++) {
+      if (pw->depth > 8) {
+        short *s = rows;
+        if (type == T_CHAR)
+          for (j=0 ; j<rowlen ; j++) s[j] = ((unsigned char *)op.value)[k++];
+        else if (type == T_INT)
+          for (j=0 ; j<rowlen ; j++) s[j] = ((int *)op.value)[k++];
+        else
+          for (j=0 ; j<rowlen ; j++) s[j] = ((long *)op.value)[k++];
+      } else {
+        unsigned char *c = rows;
+        if (type == T_SHORT)
+          for (j=0 ; j<rowlen ; j++) c[j] = ((short *)op.value)[k++];
+        else if (type == T_INT)
+          for (j=0 ; j<rowlen ; j++) c[j] = ((int *)op.value)[k++];
+        else
+          for (j=0 ; j<rowlen ; j++) c[j] = ((long *)op.value)[k++];
+      }
+      rslt = sp_write_rows(pw->w, rows, 1L);
+    }
+    p_free(rows);
+  }
+  if (rslt) ypng_werror(pw, rslt, "png_write_rows");
+}
+
+void
+Y_png_close(int nArgs)
+{
+  ypng_writer *pw;
+  int rslt;
+  if (nArgs != 1) YError("png_close takes exactly 1 argument");
+  pw = ypng_wget(sp, "png_close");
+  rslt = sp_write_close(pw->w);
+  pw->w = 0;
+  if (rslt) ypng_werror(pw, rslt, "png_close");
+}
+
+static ypng_writer *
+ypng_wget(Symbol *stack, char *fname)
+{
+  char msg[80];
+  Operand op;
+  if (!stack->ops) YError("png_writer functions take no keywords");
+  stack->ops->FormOperand(stack, &op);
+  if (op.ops != &ypng_wops) {
+    sprintf(msg, "%.20s: first argument must be a png_writer", fname);
+    YError(msg);
+  }
+  if (!((ypng_writer *)op.value)->w) {
+    sprintf(msg, "%.20s: png_writer has been closed", fname);
+    YError(msg);
+  }
+  return op.value;
+}
+
+static void
+ypng_werror(ypng_writer *pw, int rslt, char *fname)
+{
+  char msg[160];
+  if (rslt == 1)
+    sprintf(msg, "%.20s: image incomplete, %.60s abandoned", fname,
+            pw->name);
+  else
+    sprintf(msg, "%.20s: PNG ERROR: %.96s", fname, pw->info.msg);
+  if (pw->w && rslt==3) {
+    /* libpng has already destroyed the write struct */
+    sp_write_close(pw->w);
+    pw->w = 0;
+  }
+  YError(msg);
 }
 
 /* for simage or cimage */
@@ -14,36 +14,151 @@
 #include "pstdlib.h"
 #include "play.h"
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 
 #include "zlib.h"
 
+#ifdef YZ_PTHREAD
+   /* -DYZ_PTHREAD to allow z_deflate threads= to use multiple threads */
+#  include <pthread.h>
+#  include <unistd.h>
+#endif
+
+#ifdef YZ_ZSTD
+   /* -DYZ_ZSTD to allow z_deflate codec="zstd" */
+#  include "zstd.h"
+#endif
+#ifdef YZ_LZ4
+   /* -DYZ_LZ4 to allow z_deflate codec="lz4" */
+#  include "lz4frame.h"
+#endif
+#ifdef YZ_LIBDEFLATE
+   /* -DYZ_LIBDEFLATE for faster one-shot z_deflate and z_inflate */
+#  include "libdeflate.h"
+#endif
+
 extern BuiltIn Y_z_deflate, Y_z_inflate, Y_z_flush, Y_z_setdict, Y_z_crc32;
+extern BuiltIn Y_z_deflate_batch, Y_z_inflate_batch, Y_z_pool;
+extern BuiltIn Y_z_dict_train, Y_z_stats, Y_z_target;
+extern BuiltIn Y_z_deflate_async, Y_z_wait;
 
 /*--------------------------------------------------------------------------*/
 
 typedef struct yz_stream yz_stream;
-typedef struct yz_block yz_block;
+typedef struct yz_pjob yz_pjob;
+typedef struct yz_sink yz_sink;
 
 /* implement zlib state as a foreign yorick data type */
 struct yz_stream {
   int references;      /* reference counter */
   Operations *ops;     /* virtual function table */
   int status;          /* 1 deflate, 2 inflate, 3 inflate/done, 0 ended */
-  yz_block *chunk;     /* output chunks */
+  Array *out;          /* output buffer, 1D char array grown as needed */
+  long used;           /* number of bytes of out holding output */
   Bytef *dict;         /* inflate dictionary */
   uInt ldict;
   int need_dict;       /* adler valid */
   uLong adler;         /* checksum for required dictionary */
-  z_stream zs;         /* zlib stream state, see zlib.h */
+  int level;           /* deflate compression level */
+  int strategy;        /* deflate strategy (strategy=) */
+  int memlevel;        /* deflate memLevel (memlevel=) */
+  int wbits;           /* deflate window bits, 9-15 (wbits=) */
+  long speed;          /* MB/s target for automatic level (speed=) */
+  int nthreads;        /* >0 for block-parallel deflate (threads=) */
+  yz_pjob *jobs;       /* block-parallel deflate work list */
+  Bytef *pend;         /* input waiting for a full block (threads=) */
+  long npend;
+  Bytef *window;       /* final 32k of input so far (threads=) */
+  long nwindow;
+  uLong check;         /* adler32 of all input so far (threads=) */
+  unsigned long lhint; /* expected total inflate output (size=) */
+  int format;          /* YZ_ZLIB, YZ_GZIP, YZ_RAW, or YZ_AUTO (format=) */
+  int gzip;            /* set when inflating gzip, which may have members */
+  Bytef hold[2];       /* inflate: stream or member header bytes held */
+  int nhold;           /* until the next call decides what follows */
+  unsigned long nin;   /* total input bytes mod 2^32 (threads=, gzip) */
+  int codec;           /* YZ_CZLIB, YZ_CZSTD, or YZ_CLZ4 (codec=) */
+  void *cctx;          /* zstd or lz4 (de)compression context */
+  int filter;          /* YZ_DELTA|YZ_SHUFFLE|YZ_BITSHUF bits (filter=) */
+  int elsize;          /* filter element size in bytes */
+  int fstate;          /* deflate: 1 after filter header written
+                        * inflate: 0 unknown, 1 unfiltered, 2 filtered */
+  long fready;         /* inflate: bytes of out ready for z_flush */
+  Bytef *fbuf;         /* deflate: input waiting for a full filter block */
+  long nfbuf;
+  Bytef *ftmp;         /* filter scratch, 2*YZ_FBLOCK bytes */
+  yz_sink *sink;       /* deflate: output file (file=), or 0 */
+  int inflate;         /* 1 for inflate buffer, even after status 0 */
+  unsigned long tin;   /* statistics: total input bytes */
+  unsigned long nflushed;  /* output removed by z_flush or written */
+  unsigned long ndirect;   /* output written to z_inflate data */
+  double cpu;          /* cpu seconds in z_deflate, z_inflate, z_flush */
+  long chunks;         /* number of calls with input */
+  Array **targ;        /* inflate: z_target output arrays, or 0 */
+  long ntarg, itarg;   /* number of targets, index of current target */
+  unsigned long toff;  /* bytes written to current target */
+  unsigned long tdone; /* bytes in targets before current target */
+  z_stream zs;         /* zlib stream state, see zlib.h, or for other
+                        * codecs only total_in and total_out are used */
 };
 
-struct yz_block {
-  yz_block *prev;
-  unsigned long used, avail;
-  Byte data[sizeof(long)];
+/* output file for z_deflate file=, see yz_sink_open */
+struct yz_sink {
+  FILE *f;
+  unsigned long nwritten;  /* bytes written or being written */
+  int writer;              /* 1 if using background writer thread */
+  int error;               /* set if a write failed */
+  Array *buf;              /* buffer being written by writer thread */
+  long nbuf;
+#ifdef YZ_PTHREAD
+  pthread_t thread;
+  int busy;                /* set while writer thread running */
+#endif
 };
 
-extern yz_stream *yz_create(int inflate, int level);
+/* opts[YZ_NOPTS] are optional parameters for yz_create, 0 for defaults */
+#define YZ_THREADS 0
+#define YZ_SIZE 1
+#define YZ_FORMAT 2
+#define YZ_CODEC 3
+#define YZ_FILTER 4
+#define YZ_ELSIZE 5
+#define YZ_STRATEGY 6
+#define YZ_MEMLEVEL 7
+#define YZ_WBITS 8
+#define YZ_SPEED 9
+#define YZ_NOPTS 10
+
+/* values of opts[YZ_FORMAT], index into yz_wbits and yz_fnames */
+#define YZ_ZLIB 0
+#define YZ_GZIP 1
+#define YZ_RAW 2
+#define YZ_AUTO 3
+
+/* opts[YZ_FILTER] bits, see yz_flnames */
+#define YZ_DELTA 1
+#define YZ_SHUFFLE 2
+#define YZ_BITSHUF 4
+
+/* values of opts[YZ_CODEC], index into yz_cnames */
+#define YZ_CZLIB 0
+#define YZ_CZSTD 1
+#define YZ_CLZ4 2
+
+#define YZ_MAX_THREADS 256
+
+/* z_deflate file= writes output in blocks of this size */
+#define YZ_SINKBLK 1048576L
+
+/* zlib avail_in and avail_out are 32-bit uInt, so deflate and inflate
+ * see larger arrays in slices of at most this many bytes */
+#ifndef YZ_ZSLICE
+#define YZ_ZSLICE 1073741824UL
+#endif
+
+extern yz_stream *yz_create(int inflate, int level, long *opts);
 extern void yz_free(void *yzs);  /* ******* Use Unref(yzs) ******* */
 extern Operations yz_ops;
 
@@ -57,6 +172,7 @@ extern UnaryOp EvalX, SetupX, PrintX;
 extern MemberOp GetMemberX;
 
 static UnaryOp yz_print;
+static MemberOp yz_getmember;
 
 Operations yz_ops = {
   &yz_free, T_OPAQUE, 0, T_STRING, "zlib_stream",
@@ -66,20 +182,66 @@ Operations yz_ops = {
   &AddX, &SubtractX, &MultiplyX, &DivideX, &ModuloX, &PowerX,
   &EqualX, &NotEqualX, &GreaterX, &GreaterEQX,
   &ShiftLX, &ShiftRX, &OrX, &AndX, &XorX,
-  &AssignX, &EvalX, &SetupX, &GetMemberX, &MatMultX, &yz_print
+  &AssignX, &EvalX, &SetupX, &yz_getmember, &MatMultX, &yz_print
 };
 
 /*--------------------------------------------------------------------------*/
 
+static int yz_par_init(yz_stream *yzs);
+static void yz_par_free(yz_stream *yzs);
+static void yz_par_header(yz_stream *yzs, Bytef *dict, long ldict);
+static void yz_par_deflate(yz_stream *yzs,
+                           Bytef *data, unsigned long ldata, int flush);
+static uLong yz_par_cksum(int use_adler32, uLong cksum,
+                          Bytef *data, unsigned long ldata, int nthreads);
+static int yz_ncpu(void);
+static int yz_cinit(yz_stream *yzs, int inflate, int nthreads);
+static void yz_cfree(yz_stream *yzs, int inflate);
+static void yz_cdeflate(yz_stream *yzs,
+                        Bytef *data, unsigned long ldata, int flush);
+static long yz_cinflate(yz_stream *yzs, int targ,
+                        Bytef *zdata, unsigned long lzdata,
+                        Bytef *data, unsigned long ldata,
+                        unsigned long *ndata);
+static voidpf yz_zalloc(voidpf opaque, uInt items, uInt size);
+static void yz_zfree(voidpf opaque, voidpf address);
+static int yz_oneshot(yz_stream *yzs);
+static void yz_odeflate(yz_stream *yzs, Bytef *data, unsigned long ldata);
+static int yz_oinflate(yz_stream *yzs, Bytef *zdata, unsigned long lzdata,
+                       Bytef *data, unsigned long ldata,
+                       unsigned long *ndata);
+static void yz_sink_close(yz_sink *sink, int check);
+static void yz_tclear(yz_stream *yzs);
+static Bytef *yz_tnext(yz_stream *yzs, unsigned long *len);
+static unsigned long yz_tout(yz_stream *yzs);
+static void yz_stats(yz_stream *yzs, unsigned long lin, unsigned long tout0,
+                     double cpu0);
+/* z_stats: [buffers, chunks, bytes in, bytes out, cpu] deflate, inflate */
+static double yz_gstats[2][5];
+
 /* Set up a block allocator which grabs space for 32 yz_stream objects
  * at a time.  Since yz_stream contains an ops pointer, the alignment
  * of a yz_stream must be at least as strict as a void*.  */
 static MemryBlock yz_mblock = {0, 0, sizeof(yz_stream), 32*sizeof(yz_stream)};
 
+/* zlib windowBits for each format, 32+ accepts zlib or gzip header */
+static int yz_wbits[4] = { MAX_WBITS, 16+MAX_WBITS, -MAX_WBITS, 32+MAX_WBITS };
+static char *yz_fnames[5] = { "zlib", "gzip", "raw", "auto", 0 };
+static char *yz_cnames[4] = { "zlib", "zstd", "lz4", 0 };
+/* strategy= names, index is the zlib strategy */
+static char *yz_snames[6] = { "default", "filtered", "huffman", "rle",
+                              "fixed", 0 };
+/* filter= names, index is opts[YZ_FILTER] bits */
+static char *yz_flnames[7] = { "none", "delta", "shuffle", "delta+shuffle",
+                               "bitshuffle", "delta+bitshuffle", 0 };
+
 yz_stream *
-yz_create(int inflate, int level)
+yz_create(int inflate, int level, long *opts)
 {
   int status;
+  int nthreads = (!inflate && opts)? (int)opts[YZ_THREADS] : 0;
+  int format = opts? (int)opts[YZ_FORMAT] : YZ_ZLIB;
+  int codec = opts? (int)opts[YZ_CODEC] : YZ_CZLIB;
   yz_stream *yzs = NextUnit(&yz_mblock);
   yzs->references = 0;
   yzs->ops = &yz_ops;
@@ -87,22 +249,77 @@ yz_create(int inflate, int level)
    * void (*zfree)(voidpf opaque, voidpf address)
    *   uInt is unsigned int, voidpf is void FAR *, declared in zlib.h
    */
-  yzs->zs.zalloc = Z_NULL;
-  yzs->zs.zfree = Z_NULL;
+  yzs->zs.zalloc = &yz_zalloc;
+  yzs->zs.zfree = &yz_zfree;
   yzs->zs.opaque = Z_NULL;
   yzs->zs.data_type = Z_UNKNOWN;
 
-  yzs->chunk = 0;
+  yzs->out = 0;
+  yzs->used = 0;
   yzs->dict = 0;
   yzs->ldict = 0;
   yzs->need_dict = 0;
   yzs->adler = 0;
+  yzs->level = level;
+  yzs->strategy = (!inflate && opts)? (int)opts[YZ_STRATEGY] : 0;
+  yzs->memlevel = (!inflate && opts && opts[YZ_MEMLEVEL])?
+    (int)opts[YZ_MEMLEVEL] : 8;
+  yzs->wbits = (!inflate && opts && opts[YZ_WBITS])?
+    (int)opts[YZ_WBITS] : MAX_WBITS;
+  yzs->speed = (!inflate && opts)? opts[YZ_SPEED] : 0;
+  yzs->nthreads = nthreads;
+  yzs->jobs = 0;
+  yzs->pend = yzs->window = 0;
+  yzs->npend = yzs->nwindow = 0;
+  yzs->format = format;
+  yzs->gzip = (format == YZ_GZIP);
+  yzs->nhold = 0;
+  yzs->nin = 0;
+  yzs->codec = YZ_CZLIB;
+  yzs->cctx = 0;
+  yzs->filter = (!inflate && opts)? (int)opts[YZ_FILTER] : 0;
+  yzs->elsize = (!inflate && opts)? (int)opts[YZ_ELSIZE] : 0;
+  /* inflate looks for a filter header only if asked (filter=1) */
+  yzs->fstate = (inflate && !(opts && opts[YZ_FILTER]));
+  yzs->fready = 0;
+  yzs->fbuf = yzs->ftmp = 0;
+  yzs->nfbuf = 0;
+  yzs->sink = 0;
+  yzs->inflate = inflate;
+  yzs->tin = yzs->nflushed = yzs->ndirect = 0;
+  yzs->cpu = 0.0;
+  yzs->chunks = 0;
+  yzs->targ = 0;
+  yzs->ntarg = yzs->itarg = 0;
+  yzs->toff = yzs->tdone = 0;
+  yzs->zs.total_in = yzs->zs.total_out = 0;
+  yzs->check = yzs->gzip? crc32(0L, Z_NULL, 0) : adler32(0L, Z_NULL, 0);
+  yzs->lhint = (inflate && opts && opts[YZ_SIZE]>0)? opts[YZ_SIZE] : 0;
   yzs->status = 0;
-  status = inflate? inflateInit(&yzs->zs) : deflateInit(&yzs->zs, level);
+  if (codec != YZ_CZLIB) {
+    /* zstd threads= are its own workers, not yz_par_deflate blocks */
+    yzs->codec = codec;
+    yzs->nthreads = 0;
+    status = yz_cinit(yzs, inflate, nthreads);
+  } else if (nthreads > 0)
+    /* each block gets its own z_stream in yz_par_deflate */
+    status = (level<Z_DEFAULT_COMPRESSION || level>Z_BEST_COMPRESSION)?
+      Z_STREAM_ERROR : yz_par_init(yzs);
+  else if (inflate)
+    status = inflateInit2(&yzs->zs, yz_wbits[format]);
+  else
+    status = deflateInit2(&yzs->zs, level, Z_DEFLATED,
+                          (format==YZ_RAW)? -yzs->wbits :
+                          yz_wbits[format] - MAX_WBITS + yzs->wbits,
+                          yzs->memlevel, yzs->strategy);
 
   if (status != Z_OK) {
+    yz_par_free(yzs);
+    yz_cfree(yzs, inflate);
     FreeUnit(&yz_mblock, yzs);
-    if (status == Z_STREAM_ERROR)
+    if (status == Z_VERSION_ERROR && codec != YZ_CZLIB)
+      YError("z_deflate/z_inflate: yorick-z built without this codec=");
+    else if (status == Z_STREAM_ERROR)
       YError("zlib (deflate): invalid compression level");
     else if (status == Z_VERSION_ERROR)
       YError("zlib (deflate/inflate): libz version mismatch");
@@ -114,68 +331,233 @@ yz_create(int inflate, int level)
   }
 
   yzs->status = inflate? 2 : 1;
+  yz_gstats[inflate][0] += 1.0;
   return yzs;
 }
 
-static void yz_free_chunk(yz_block *yzbp);
-
 void
 yz_free(void *yzsv)  /* ******* Use Unref(yzs) ******* */
 {
   yz_stream *yzs = yzsv;
   int status;
   if (!yzs) return;
-  yz_free_chunk(yzs->chunk);
-  yzs->chunk = 0;
+  Unref(yzs->out);
+  yzs->out = 0;
+  yzs->used = 0;
   if (yzs->dict) {
     p_free(yzs->dict);
     yzs->dict = 0;
   }
+  if (yzs->fbuf) p_free(yzs->fbuf);
+  if (yzs->ftmp) p_free(yzs->ftmp);
+  yzs->fbuf = yzs->ftmp = 0;
+  if (yzs->sink) yz_sink_close(yzs->sink, 0);
+  yzs->sink = 0;
+  yz_tclear(yzs);
   status = yzs->status;
   yzs->status = 0;
-  if (status == 1) deflateEnd(&yzs->zs);
-  else if (status==2 && status==3) inflateEnd(&yzs->zs);
+  if (yzs->codec) yz_cfree(yzs, status!=1);
+  else if (yzs->nthreads) yz_par_free(yzs);
+  else if (status == 1) deflateEnd(&yzs->zs);
+  else if (status == 2) inflateEnd(&yzs->zs);
   FreeUnit(&yz_mblock, yzs);
 }
 
-static void
-yz_free_chunk(yz_block *yzb)
-{
-  if (yzb) {
-    if (yzb->prev) yz_free_chunk(yzb->prev);
-    yzb->prev = 0;
-    p_free(yzb);
-  }
-}
-
 static void
 yz_print(Operand *op)
 {
   yz_stream *yzs = op->value;
+  char line[120];
   ForceNewline();
   if (yzs->status==1) PrintFunc("zlib deflate buffer object");
   else if (yzs->status==2) PrintFunc("zlib inflate buffer object");
   else if (yzs->status==3) PrintFunc("zlib finished inflate buffer object");
   else PrintFunc("zlib buffer object, (de)compression finished");
   ForceNewline();
+  sprintf(line, "  %lu bytes in, %lu bytes out, %ld chunks, %.3f cpu seconds",
+          yzs->tin, yz_tout(yzs), yzs->chunks, yzs->cpu);
+  PrintFunc(line);
+  ForceNewline();
+}
+
+/* total output so far, whether still in buffer or not */
+static unsigned long
+yz_tout(yz_stream *yzs)
+{
+  return yzs->nflushed + yzs->used + yzs->ndirect +
+    (yzs->sink? yzs->sink->nwritten : 0);
+}
+
+/* record statistics for one z_deflate, z_inflate, or z_flush call,
+ * given yz_tout and p_cpu_secs before the call */
+static void
+yz_stats(yz_stream *yzs, unsigned long lin, unsigned long tout0,
+         double cpu0)
+{
+  double *g = yz_gstats[yzs->inflate];
+  double cpu = p_cpu_secs((double *)0) - cpu0;
+  yzs->tin += lin;
+  yzs->cpu += cpu;
+  yzs->chunks++;
+  g[1] += 1.0;
+  g[2] += (double)lin;
+  g[3] += (double)(yz_tout(yzs) - tout0);
+  g[4] += cpu;
+}
+
+/* buf.member returns statistics, see help,z_stats */
+static void
+yz_getmember(Operand *op, char *name)
+{
+  yz_stream *yzs = op->value;
+  Symbol *owner = op->owner;
+  DataBlock *old = (owner->ops == &dataBlockSym)? owner->value.db : 0;
+  double tin = (double)yzs->tin, tout = (double)yz_tout(yzs), x = 0.0;
+  long l = 0;
+  int real = 0;
+  Array *result;
+  if (!strcmp(name, "total_in")) {
+    l = (long)yzs->tin;
+  } else if (!strcmp(name, "total_out")) {
+    l = (long)yz_tout(yzs);
+  } else if (!strcmp(name, "ratio")) {
+    /* uncompressed over compressed size for either direction */
+    real = 1;
+    if (yzs->inflate) x = (tin > 0.0)? tout/tin : 0.0;
+    else x = (tout > 0.0)? tin/tout : 0.0;
+  } else if (!strcmp(name, "cpu_seconds")) {
+    real = 1;
+    x = yzs->cpu;
+  } else if (!strcmp(name, "chunks")) {
+    l = yzs->chunks;
+  } else if (!strcmp(name, "bytes_buffered")) {
+    l = yzs->used + yzs->npend + yzs->nfbuf;
+  } else {
+    YError("zlib_stream members: total_in, total_out, ratio, cpu_seconds, "
+           "chunks, bytes_buffered");
+  }
+  result = NewArray(real? &doubleStruct : &longStruct, (Dimension *)0);
+  if (real) result->value.d[0] = x;
+  else result->value.l[0] = l;
+  owner->ops = &dataBlockSym;
+  owner->value.db = (DataBlock *)result;
+  Unref(old);
+}
+
+/* z_stats totals over all buffers, [buffers, chunks, bytes in,
+ * bytes out, cpu seconds] for deflate and inflate */
+void
+Y_z_stats(int nArgs)
+{
+  Array *result;
+  int i, j;
+  if (nArgs > 1) YError("z_stats takes 0 or 1 argument");
+  if (nArgs==1 && YNotNil(sp)) {
+    if (YGetInteger(sp)) YError("z_stats: only z_stats, 0 is allowed");
+    for (i=0 ; i<2 ; i++) for (j=0 ; j<5 ; j++) yz_gstats[i][j] = 0.0;
+    return;
+  }
+  result = (Array *)PushDataBlock(NewArray(&doubleStruct,
+                                           ynew_dim(2, ynew_dim(5, (void*)0))));
+  for (i=0 ; i<2 ; i++)
+    for (j=0 ; j<5 ; j++) result->value.d[5*i+j] = yz_gstats[i][j];
 }
 
+static int yz_getargs(int nArgs, Symbol **args, int maxArgs, char **knames,
+                      long *kglobs, Symbol **keys, char *fname);
 static Bytef *yz_getspace(yz_stream *yzs, unsigned long nbytes);
+static Bytef *yz_reserve(yz_stream *yzs, unsigned long nbytes);
+static unsigned long yz_inflate_guess(yz_stream *yzs, unsigned long lzdata);
+static uInt yz_slice(unsigned long *left);
+static void yz_append(yz_stream *yzs, Bytef *data, unsigned long ldata);
 static void yz_do_deflate(yz_stream *yzs,
                           Bytef *data, unsigned long ldata, int flush);
+static void yz_zdeflate(yz_stream *yzs,
+                        Bytef *data, unsigned long ldata, int flush);
+static void yz_autolevel(yz_stream *yzs, Bytef *data, unsigned long ldata);
+
+static int yz_getformat(Symbol *key, int inflate, char *fname);
+
+static int yz_getcodec(Symbol *key, char *fname);
+static yz_sink *yz_sink_open(char *name, int writer);
+static void yz_sink_write(yz_stream *yzs, long nbytes);
+static long yz_sink_flush(yz_stream *yzs);
+static int yz_getfilter(Symbol *key, Symbol *ekey, long *elsize);
+static void yz_fdeflate(yz_stream *yzs,
+                        Bytef *data, unsigned long ldata, int flush);
+static long yz_fpost(yz_stream *yzs, int flag, Bytef *udata,
+                     unsigned long ludata, unsigned long ndata, int redir);
+
+static char *yz_deflate_knames[] = { "threads", "format", "codec", "filter",
+                                     "elsize", "file", "writer", "strategy",
+                                     "memlevel", "wbits", "speed", 0 };
+static long yz_deflate_kglobs[12];
 
 void
 Y_z_deflate(int nArgs)
 {
-  int level = Z_DEFAULT_COMPRESSION;
+  int level = Z_DEFAULT_COMPRESSION, elsize = 1;
   yz_stream *yzs = 0;
   Bytef *data = 0;
   unsigned long ldata = 0;
+  Symbol *args[2], *keys[11];
+  long opts[YZ_NOPTS];
+  char *file = 0;
+  int i;
+  nArgs = yz_getargs(nArgs, args, 2, yz_deflate_knames, yz_deflate_kglobs,
+                     keys, "z_deflate");
+  opts[YZ_THREADS] = opts[YZ_SIZE] = 0;
+  if (keys[0] && YNotNil(keys[0])) {
+    opts[YZ_THREADS] = YGetInteger(keys[0]);
+    if (opts[YZ_THREADS]<1 || opts[YZ_THREADS]>YZ_MAX_THREADS)
+      YError("z_deflate: threads= must be between 1 and 256");
+  }
+  opts[YZ_FORMAT] = yz_getformat(keys[1], 0, "z_deflate");
+  opts[YZ_CODEC] = yz_getcodec(keys[2], "z_deflate");
+  if (opts[YZ_CODEC]!=YZ_CZLIB && opts[YZ_FORMAT]!=YZ_ZLIB)
+    YError("z_deflate: format= only allowed with codec=\"zlib\"");
+  if (opts[YZ_CODEC]==YZ_CLZ4 && opts[YZ_THREADS])
+    YError("z_deflate: threads= not allowed with codec=\"lz4\"");
+  opts[YZ_FILTER] = yz_getfilter(keys[3], keys[4], opts+YZ_ELSIZE);
+  if (keys[5] && YNotNil(keys[5])) {
+    file = YGetString(keys[5]);
+    if (!file || !file[0]) YError("z_deflate: file= must be a file name");
+  }
+  if (keys[6] && !file) YError("z_deflate: writer= only allowed with file=");
+  opts[YZ_STRATEGY] = opts[YZ_MEMLEVEL] = opts[YZ_WBITS] = opts[YZ_SPEED] = 0;
+  if (keys[7] && YNotNil(keys[7])) {
+    char *name = YGetString(keys[7]);
+    for (i=0 ; yz_snames[i] ; i++)
+      if (name && !strcmp(name, yz_snames[i])) break;
+    if (!yz_snames[i])
+      YError("z_deflate: strategy= must be \"default\", \"filtered\", "
+             "\"huffman\", \"rle\", or \"fixed\"");
+    opts[YZ_STRATEGY] = i;
+  }
+  if (keys[8] && YNotNil(keys[8])) {
+    opts[YZ_MEMLEVEL] = YGetInteger(keys[8]);
+    if (opts[YZ_MEMLEVEL]<1 || opts[YZ_MEMLEVEL]>MAX_MEM_LEVEL)
+      YError("z_deflate: memlevel= must be between 1 and 9");
+  }
+  if (keys[9] && YNotNil(keys[9])) {
+    opts[YZ_WBITS] = YGetInteger(keys[9]);
+    if (opts[YZ_WBITS]<9 || opts[YZ_WBITS]>MAX_WBITS)
+      YError("z_deflate: wbits= must be between 9 and 15");
+    if (opts[YZ_THREADS])
+      YError("z_deflate: wbits= not allowed with threads=");
+  }
+  if (keys[10] && YNotNil(keys[10])) {
+    double speed = YGetReal(keys[10]);
+    if (speed <= 0.0) YError("z_deflate: speed= must be positive MB/s");
+    opts[YZ_SPEED] = (speed < 1.0)? 1 : (long)speed;
+  }
+  if (opts[YZ_CODEC]!=YZ_CZLIB &&
+      (keys[7] || keys[8] || keys[9] || keys[10]))
+    YError("z_deflate: strategy=, memlevel=, wbits=, speed= need "
+           "codec=\"zlib\"");
   if (nArgs > 0) {
     Operand op;
-    Symbol *stack = sp-nArgs+1;
-    if (nArgs > 2) YError("z_deflate takes at most 2 arguments");
-    if (!stack->ops) YError("z_deflate takes no keywords");
+    Symbol *stack = args[0];
     stack->ops->FormOperand(stack, &op);
     if (op.ops == &yz_ops) {
       yzs = op.value;
@@ -183,11 +565,13 @@ Y_z_deflate(int nArgs)
         YError("z_deflate: cannot use inflate state for deflate call");
       else if (yzs->status != 1)
         YError("z_deflate: deflate buffer closed, compression finished");
+      for (i=0 ; i<11 ; i++)
+        if (keys[i]) YError("z_deflate: keywords only allowed creating buffer");
     } else if (op.value != &nilDB) {
       level = (int)YGetInteger(stack);
     }
     if (nArgs > 1) {
-      stack++;
+      stack = args[1];
       stack->ops->FormOperand(stack, &op);
       if (op.value != &nilDB) {
         if (!op.ops->isArray)
@@ -196,14 +580,23 @@ Y_z_deflate(int nArgs)
           YError("z_deflate cannot handle string or pointer data types");
         ldata = op.type.number * op.type.base->size;
         data = op.value;
+        elsize = op.type.base->size;
       }
     }
   }
 
   if (!yzs) {
     /* create a new zlib state buffer */
-    yzs = (yz_stream *)PushDataBlock(yz_create(0, level));
-    if (data) {
+    if (data && (opts[YZ_FORMAT]!=YZ_ZLIB || opts[YZ_CODEC]!=YZ_CZLIB))
+      YError("z_deflate: dictionary only allowed with format=\"zlib\"");
+    if (ldata > 0xffffffffUL)
+      YError("z_deflate: dictionary must be smaller than 4 GB");
+    yzs = (yz_stream *)PushDataBlock(yz_create(0, level, opts));
+    if (file)
+      yzs->sink = yz_sink_open(file, keys[6]? YGetInteger(keys[6])!=0 : 0);
+    if (yzs->nthreads) {
+      yz_par_header(yzs, data, ldata);
+    } else if (data) {
       int flag = deflateSetDictionary(&yzs->zs, data, (uInt)ldata);
       if (flag != Z_OK) {
         yzs->status = 0;
@@ -217,14 +610,19 @@ Y_z_deflate(int nArgs)
 
   } else {
     /* compress a chunk of data */
-    long ntotal = 0;
-    yz_block *chunk;
+    unsigned long tout0 = yz_tout(yzs);
+    double cpu0 = p_cpu_secs((double *)0);
+    if (data && !yzs->elsize) yzs->elsize = elsize;
     yz_do_deflate(yzs, data, ldata, Z_NO_FLUSH);
-    for (chunk=yzs->chunk ; chunk ; chunk=chunk->prev) ntotal += chunk->used;
-    PushLongValue(ntotal>1023? ntotal : 0L);
+    yz_stats(yzs, ldata, tout0, cpu0);
+    if (yzs->sink) PushLongValue(yzs->sink->nwritten);
+    else PushLongValue(yzs->used>1023? yzs->used : 0L);
   }
 }
 
+static char *yz_flush_knames[] = { "sync", 0 };
+static long yz_flush_kglobs[2];
+
 void
 Y_z_flush(int nArgs)
 {
@@ -233,14 +631,15 @@ Y_z_flush(int nArgs)
   unsigned long ldata = 0;
   StructDef *type = &charStruct;
   Operand op;
-  long i=0, lbuf, nbytes=0, nitems=0, nextra=0;
-  yz_block *k, *n, *t;
+  long nbytes, nitems, nextra=0;
   Array *array;
-  unsigned char *c;
   char junk[4];
-  Symbol *stack = sp-nArgs+1;
-  if (nArgs<1 || nArgs>2) YError("z_flush takes 1 or 2 arguments");
-  if (!stack->ops) YError("z_flush takes no keywords");
+  Symbol *args[2], *keys[1], *stack;
+  int flush = Z_FINISH, deflating;
+  nArgs = yz_getargs(nArgs, args, 2, yz_flush_knames, yz_flush_kglobs,
+                     keys, "z_flush");
+  if (nArgs < 1) YError("z_flush takes 1 or 2 arguments");
+  stack = args[0];
   stack->ops->FormOperand(stack, &op);
   if (op.ops == &yz_ops) {
     yzs = op.value;
@@ -249,14 +648,24 @@ Y_z_flush(int nArgs)
   } else {
     YError("z_flush first parameter must be a zlib buffer");
   }
+  if (keys[0] && YNotNil(keys[0])) {
+    long sync = YGetInteger(keys[0]);
+    if (yzs->status != 1)
+      YError("z_flush: sync= only allowed for deflate buffer");
+    if (sync<0 || sync>2)
+      YError("z_flush: sync= must be 0, 1, or 2");
+    if (sync) flush = (sync==1)? Z_SYNC_FLUSH : Z_FULL_FLUSH;
+  }
   if (nArgs > 1) {
-    stack++;
+    stack = args[1];
     stack->ops->FormOperand(stack, &op);
     if (yzs->status == 1) {
       if (op.ops == &rangeOps) {
         Range *r = op.value;
         if (r->nilFlags!=11 || r->inc!=1)
           YError("z_flush deflate data must be an array data type or -");
+        if (flush != Z_FINISH)
+          YError("z_flush: sync= cannot be used with -");
 	data = (Bytef *)junk;
       } else if (op.value != &nilDB) {
         if (!op.ops->isArray)
@@ -265,6 +674,7 @@ Y_z_flush(int nArgs)
           YError("z_flush cannot handle string or pointer data types");
         ldata = op.type.number * op.type.base->size;
         data = op.value;
+        if (!yzs->elsize) yzs->elsize = op.type.base->size;
       }
     } else if (op.ops == &structDefOps) {
       type = op.value;
@@ -278,18 +688,28 @@ Y_z_flush(int nArgs)
   }
 
   if (yzs->status == 1) {
-    /* deflate final chunk if given */
-    if (data) yz_do_deflate(yzs, data, ldata, Z_FINISH);
+    /* deflate final chunk if given, or flush with sync= */
+    if (data || flush!=Z_FINISH) {
+      unsigned long tout0 = yz_tout(yzs);
+      double cpu0 = p_cpu_secs((double *)0);
+      if (ldata && flush==Z_FINISH && yz_oneshot(yzs))
+        yz_odeflate(yzs, data, ldata);
+      else
+        yz_do_deflate(yzs, data, ldata, flush);
+      yz_stats(yzs, ldata, tout0, cpu0);
+    }
+    if (yzs->sink) {
+      /* with file=, return total bytes written to the file */
+      PushLongValue(yz_sink_flush(yzs));
+      return;
+    }
   }
 
-  /* reverse list of chunks, count total bytes */
-  for (n=0,k=yzs->chunk ; k ; n=k,k=t) {
-    nbytes += k->used;
-    t = k->prev;
-    k->prev = n;
-  }
-  yzs->chunk = n;
-  /* extract compressed data to zdata return value */
+  /* extract compressed data to zdata return value, for inflate only
+   * the part already passed through any filter= (see yz_fpost)
+   * status 0 here is a deflate stream finished by this call */
+  deflating = (yzs->status < 2);
+  nbytes = deflating? yzs->used : yzs->fready;
   if (type == &charStruct) {
     nitems = nbytes;
   } else if (yzs->status==3) {
@@ -298,26 +718,37 @@ Y_z_flush(int nArgs)
     nitems = nbytes / type->size;
     nextra = nbytes - type->size*nitems;
   }
-  array = (Array *)PushDataBlock(NewArray(type, ynew_dim(nitems, (void*)0)));
-  c = (unsigned char *)array->value.c;
-  for (k=t=yzs->chunk ; k ; t=k,k=k->prev) {
-    lbuf = k->prev? k->used : k->used-nextra;
-    for (i=0 ; i<lbuf ; i++) c[i] = k->data[i];
-    c += lbuf;
-  }
-  for (lbuf=0 ; lbuf<nextra ; lbuf++) yzs->chunk->data[lbuf] = t->data[i++];
-  /* zap all but first chunk */
-  k = yzs->chunk;
-  k->avail += k->used - nextra;
-  k->used = nextra;
-  for (;;) {
-    t = k->prev;
-    if (!t) break;
-    k->prev = t->prev;
-    p_free(t);
+  if (type==&charStruct && yzs->out && nbytes==yzs->out->type.number) {
+    /* output exactly fills buffer, hand it back without a copy */
+    PushDataBlock(yzs->out);
+    yzs->out = 0;
+    yzs->nflushed += nbytes;
+    yzs->used = yzs->fready = 0;
+  } else {
+    array = (Array *)PushDataBlock(NewArray(type, ynew_dim(nitems, (void*)0)));
+    nitems *= type->size;
+    if (nbytes-nextra) memcpy(array->value.c, yzs->out->value.c, nbytes-nextra);
+    if (nitems > nbytes) memset(array->value.c+nbytes, 0, nitems-nbytes);
+    /* keep any partial item (and unfiltered output) at the beginning
+     * of the buffer */
+    nbytes -= nextra;
+    if (yzs->used > nbytes)
+      memmove(yzs->out->value.c, yzs->out->value.c+nbytes, yzs->used-nbytes);
+    yzs->used -= nbytes;
+    yzs->nflushed += nbytes;
+    if (!deflating) yzs->fready -= nbytes;
+  }
+  if (!yzs->used && yzs->status!=1 && yzs->status!=2) {
+    /* stream finished, no further use for output buffer */
+    Unref(yzs->out);
+    yzs->out = 0;
+    yzs->used = 0;
   }
 }
 
+static char *yz_inflate_knames[] = { "size", "format", "codec", "filter", 0 };
+static long yz_inflate_kglobs[5];
+
 void
 Y_z_inflate(int nArgs)
 {
@@ -326,11 +757,24 @@ Y_z_inflate(int nArgs)
   unsigned long lzdata = 0;
   Bytef *data = 0;
   unsigned long ldata = 0;
+  Symbol *args[3], *keys[4];
+  long opts[YZ_NOPTS];
+  nArgs = yz_getargs(nArgs, args, 3, yz_inflate_knames, yz_inflate_kglobs,
+                     keys, "z_inflate");
+  opts[YZ_THREADS] = opts[YZ_SIZE] = 0;
+  opts[YZ_FILTER] = (keys[3] && YNotNil(keys[3]) && YGetInteger(keys[3]));
+  if (keys[0] && YNotNil(keys[0])) {
+    opts[YZ_SIZE] = YGetInteger(keys[0]);
+    if (opts[YZ_SIZE] < 0)
+      YError("z_inflate: size= must be non-negative");
+  }
+  opts[YZ_FORMAT] = yz_getformat(keys[1], 1, "z_inflate");
+  opts[YZ_CODEC] = yz_getcodec(keys[2], "z_inflate");
+  if (opts[YZ_CODEC]!=YZ_CZLIB && keys[1])
+    YError("z_inflate: format= only allowed with codec=\"zlib\"");
   if (nArgs > 0) {
-    Symbol *stack = sp-nArgs+1;
+    Symbol *stack = args[0];
     Operand op;
-    if (nArgs > 3) YError("z_inflate takes at most 3 arguments");
-    if (!stack->ops) YError("z_inflate takes no keywords");
     stack->ops->FormOperand(stack, &op);
     if (op.ops == &yz_ops) {
       yzs = op.value;
@@ -338,9 +782,11 @@ Y_z_inflate(int nArgs)
         YError("z_inflate: cannot use deflate state for inflate call");
       else if (yzs->status != 2)
         YError("z_inflate: inflate buffer closed, decompression finished");
+      if (opts[YZ_SIZE] || keys[1] || keys[2] || keys[3])
+        YError("z_inflate: size=, format=, codec=, filter= only allowed "
+               "creating buffer");
       if (nArgs > 1) {
-        stack++;
-        if (!stack->ops) YError("z_inflate takes no keywords");
+        stack = args[1];
         stack->ops->FormOperand(stack, &op);
         if (op.value != &nilDB) {
           if (op.ops != &charOps)
@@ -349,7 +795,7 @@ Y_z_inflate(int nArgs)
           zdata = op.value;
         }
         if (nArgs > 2) {
-          stack++;
+          stack = args[2];
           stack->ops->FormOperand(stack, &op);
           if (!op.ops->isArray)
             YError("z_inflate output data must be an array data type");
@@ -366,29 +812,138 @@ Y_z_inflate(int nArgs)
 
   if (!yzs) {
     /* create a new zlib state buffer */
-    yzs = (yz_stream *)PushDataBlock(yz_create(1, 0));
+    yzs = (yz_stream *)PushDataBlock(yz_create(1, 0, opts));
 
   } else {
-    /* uncompress a chunk of zdata, assuming factor of 2 expansion */
-    int flag, dict_set=0;
-    unsigned long lguess = (lzdata<<1);
+    /* uncompress a chunk of zdata */
+    int flag, dict_set=0, more=0;
+    unsigned long lguess = yz_inflate_guess(yzs, lzdata);
     char junk[4];
+    Bytef *udata = data, *dend = 0;
+    unsigned long ludata = ldata, ndata = 0, zleft, dleft;
+    Bytef *dseg;
+    int redir = 0, targ = 0;
+    unsigned long tout0 = yz_tout(yzs);
+    double cpu0 = p_cpu_secs((double *)0);
+
+    if (!data && yzs->targ) {
+      udata = data = yz_tnext(yzs, &ldata);
+      ludata = ldata;
+      targ = (data != 0);
+    }
+    if (data && (yzs->fstate==2 || (!yzs->fstate && yzs->used))) {
+      /* filtered output must go through buffer, copied to data later */
+      data = 0;
+      ldata = 0;
+      redir = 1;
+    }
 
+    if (yzs->format==YZ_AUTO && zdata && !yzs->zs.total_in &&
+        yzs->nhold+lzdata < 2) {
+      /* hold a lone first byte until the format can be decided */
+      if (lzdata) yzs->hold[yzs->nhold++] = zdata[0];
+      flag = (int)yz_fpost(yzs, 1, udata, ludata, ndata, redir);
+      yz_stats(yzs, lzdata, tout0, cpu0);
+      PushLongValue(flag);
+      return;
+    }
+    /* neither magic number can begin a zlib header */
+    if ((yzs->format==YZ_AUTO || yzs->format==YZ_ZLIB) && !yzs->codec &&
+        !yzs->zs.total_in && !yzs->used && !yzs->nhold && lzdata>=4 &&
+        ((zdata[0]==0x28 && zdata[1]==0xb5 && zdata[2]==0x2f &&
+          zdata[3]==0xfd) || (zdata[0]==0x04 && zdata[1]==0x22 &&
+                              zdata[2]==0x4d && zdata[3]==0x18))) {
+      /* zstd or lz4 frame magic number, switch decoders */
+      int codec = (zdata[0]==0x28)? YZ_CZSTD : YZ_CLZ4;
+      inflateEnd(&yzs->zs);
+      yzs->zs.total_in = yzs->zs.total_out = 0;
+      yzs->codec = codec;
+      if (yz_cinit(yzs, 1, 0) != Z_OK) {
+        yzs->status = 0;
+        YError("z_inflate: zstd or lz4 data, but yorick-z built without it");
+      }
+    }
+    if (yzs->codec) {
+      flag = (int)yz_cinflate(yzs, targ, zdata, lzdata, data, ldata, &ndata);
+      flag = (int)yz_fpost(yzs, flag, udata, ludata, ndata, redir);
+      yz_stats(yzs, lzdata, tout0, cpu0);
+      PushLongValue(flag);
+      return;
+    }
+    if (yzs->format==YZ_AUTO && zdata && !yzs->zs.total_in) {
+      /* inflate recognizes zlib and gzip headers, anything else is raw */
+      int h0 = yzs->nhold? yzs->hold[0] : zdata[0];
+      int h1 = yzs->nhold? zdata[0] : zdata[1];
+      if (h0==0x1f && h1==0x8b)
+        yzs->format = YZ_GZIP;
+      else if ((h0&0x0f)==Z_DEFLATED && !(((h0<<8)|h1)%31))
+        yzs->format = YZ_ZLIB;
+      else if (inflateReset2(&yzs->zs, -MAX_WBITS) == Z_OK)
+        yzs->format = YZ_RAW;
+      yzs->gzip = (yzs->format == YZ_GZIP);
+    }
+    if (yzs->nhold) {
+      /* a held header byte cannot produce output, any error in it
+       * shows up again when inflate continues below */
+      yzs->zs.next_in = yzs->hold;
+      yzs->zs.avail_in = yzs->nhold;
+      yzs->zs.next_out = (Bytef *)junk;
+      yzs->zs.avail_out = 0;
+      inflate(&yzs->zs, Z_NO_FLUSH);
+      yzs->nhold = 0;
+    }
+    flag = zdata? yz_oinflate(yzs, zdata, lzdata, data, ldata, &ndata) : -3;
+    if (flag != -3) {
+      if (targ) yzs->toff += ndata;
+      flag = (int)yz_fpost(yzs, flag, udata, ludata, ndata, redir);
+      yz_stats(yzs, lzdata, tout0, cpu0);
+      PushLongValue(flag);
+      return;
+    }
+    zleft = lzdata;
+    dleft = data? ldata : 0;
+    dseg = data;
     yzs->zs.next_in = zdata? zdata : (Bytef *)junk;
-    yzs->zs.avail_in = lzdata;
+    yzs->zs.avail_in = yz_slice(&zleft);
+    if (data) {
+      yzs->zs.next_out = data;
+      yzs->zs.avail_out = yz_slice(&dleft);
+    }
     for (;;) {
-      if (!data) {
-        yzs->zs.next_out = yz_getspace(yzs, lguess);
-        yzs->zs.avail_out = yzs->chunk->avail;
-      } else {
-        yzs->zs.next_out = data;
-        yzs->zs.avail_out = ldata;
+      Bytef *out0 = 0;
+      if (!yzs->zs.avail_in) yzs->zs.avail_in = yz_slice(&zleft);
+      if (data && !yzs->zs.avail_out && !dleft) {
+        /* caller array full, continue in next z_target array or in
+         * internal buffer */
+        ndata += yzs->zs.next_out - dseg;
+        if (targ) {
+          yzs->toff += yzs->zs.next_out - dseg;
+          data = yz_tnext(yzs, &dleft);
+        } else {
+          data = 0;
+        }
+        dseg = dend = 0;
+        if (data) {
+          dseg = yzs->zs.next_out = data;
+          yzs->zs.avail_out = yz_slice(&dleft);
+        } else {
+          lguess = yz_inflate_guess(yzs, yzs->zs.avail_in + zleft);
+        }
       }
-      flag = inflate(&yzs->zs, Z_NO_FLUSH);
       if (!data) {
-	yzs->chunk->used += yzs->chunk->avail - yzs->zs.avail_out;
-	yzs->chunk->avail = yzs->zs.avail_out;
+        unsigned long avail;
+        out0 = yz_getspace(yzs, lguess);
+        avail = yzs->out->type.number - yzs->used;
+        yzs->zs.next_out = out0;
+        yzs->zs.avail_out = yz_slice(&avail);
+      } else if (!yzs->zs.avail_out) {
+        yzs->zs.avail_out = yz_slice(&dleft);
       }
+      flag = inflate(&yzs->zs, Z_NO_FLUSH);
+      if (!data)
+	yzs->used += yzs->zs.next_out - out0;
+      else
+        dend = yzs->zs.next_out;
       if (flag==Z_NEED_DICT && !dict_set) {
 	dict_set = 1;
 	if (yzs->dict) {
@@ -408,6 +963,26 @@ Y_z_inflate(int nArgs)
 	flag = Z_NEED_DICT;
 	/* if dict_set==1 here, yzs->dict==0 and inflateReset succeeded */
       }
+      if (flag==Z_STREAM_END && yzs->gzip) {
+        /* a gzip stream may consist of several members, continue with
+         * the next, or wait for it if this input ends with this member */
+        Bytef *next = yzs->zs.next_in;
+        unsigned long avail = yzs->zs.avail_in + zleft;
+        if ((!avail || (avail>=2 && next[0]==0x1f && next[1]==0x8b) ||
+             (avail==1 && next[0]==0x1f)) && inflateReset(&yzs->zs)==Z_OK) {
+          if (avail == 1) {
+            /* hold first byte of the next member header */
+            yzs->hold[0] = next[0];
+            yzs->nhold = 1;
+            avail = 0;
+          }
+          if (!avail) {
+            more = 1;
+            break;
+          }
+          continue;
+        }
+      }
       if (flag != Z_OK) {
 	if (flag!=Z_NEED_DICT || dict_set!=1) {
 	  yzs->status = 0;
@@ -428,29 +1003,36 @@ Y_z_inflate(int nArgs)
 	}
         break;
       }
-      if (yzs->zs.avail_out) break;
+      if (yzs->zs.avail_out) {
+        if (!zleft) break;
+        continue;    /* input slice used up, feed the next */
+      }
+      if (data) continue;
 
-      if (data) data = 0;
-      /* difficult to recompute lguess, because we don't know how much
-       * is being help in internal zlib state
-       * - so stick with initial estimate?
-       * - could be very bad if huge compression factor
-       */
+      /* output space exhausted: re-estimate from the input remaining,
+       * yz_getspace will at least double the buffer in any case */
+      lguess = yz_inflate_guess(yzs, yzs->zs.avail_in + zleft);
     }
 
-    if (flag == Z_STREAM_END) {
-      flag = yzs->zs.avail_in? -1 : 0;
+    if (more) {
+      flag = 0;  /* buffer remains open for another gzip member */
+    } else if (flag == Z_STREAM_END) {
+      flag = (yzs->zs.avail_in || zleft)? -1 : 0;
       yzs->status = 3;
     } else if (flag == Z_OK) {
-      yz_block *k;
-      for (k=yzs->chunk ; k && !k->used ; k=k->prev);
-      flag = k? 2 : 1;
+      flag = yzs->used? 2 : 1;
     } else if (flag == Z_NEED_DICT) {
       flag = 3;
     } else /* if (flag == Z_DATA_ERROR) */ {
       flag = -2;
     }
-    PushLongValue((long)flag);
+    if (dend) {
+      ndata += dend - dseg;
+      if (targ) yzs->toff += dend - dseg;
+    }
+    flag = (int)yz_fpost(yzs, flag, udata, ludata, ndata, redir);
+    yz_stats(yzs, lzdata, tout0, cpu0);
+    PushLongValue(flag);
   }
 }
 
@@ -486,6 +1068,8 @@ Y_z_setdict(int nArgs)
     if (op.ops==&stringOps || op.ops==&pointerOps)
       YError("z_setdict cannot handle string or pointer input data");
     ldict = op.type.number * op.type.base->size;
+    if ((unsigned long)ldict > 0xffffffffUL)
+      YError("z_setdict: dictionary must be smaller than 4 GB");
     dict = op.value;
     yzs->dict = p_malloc(ldict);
     yzs->ldict = ldict;
@@ -498,45 +1082,162 @@ Y_z_setdict(int nArgs)
 }
 
 void
-Y_z_crc32(int nArgs)
+Y_z_target(int nArgs)
 {
+  yz_stream *yzs = 0;
   Operand op;
   Symbol *stack = sp-nArgs+1;
-  int use_adler32;
-  uLong cksum, ldata;
-  if (nArgs<2 || nArgs>3) YError("z_crc32 takes 2 or 3 arguments");
-  if (!stack->ops || !stack[1].ops) YError("z_crc32 takes no keywords");
-  use_adler32 = (nArgs==3 && YGetInteger(stack+2)!=0);
-  if (YNotNil(stack))
-    cksum = YGetInteger(stack);
+  if (nArgs<1 || nArgs>2) YError("z_target takes 1 or 2 arguments");
+  if (!stack->ops) YError("z_target takes no keywords");
+  stack->ops->FormOperand(stack, &op);
+  if (op.ops != &yz_ops)
+    YError("z_target first parameter must be a zlib buffer");
+  yzs = op.value;
+  if (!yzs->inflate)
+    YError("z_target: buffer must be a z_inflate buffer");
+
+  if (nArgs == 2) {
+    long i, n;
+    stack++;
+    stack->ops->FormOperand(stack, &op);
+    yz_tclear(yzs);
+    if (op.value != &nilDB) {
+      if (yzs->status != 2)
+        YError("z_target: inflate buffer closed, decompression finished");
+      if (yzs->used)
+        YError("z_target: z_flush buffer before setting targets");
+      if (yzs->fstate != 1)
+        YError("z_target: cannot scatter output of filter= stream");
+      if (!op.ops->isArray || op.ops==&stringOps)
+        YError("z_target: targets must be an array or array of pointers");
+      if (op.ops == &pointerOps) {
+        void **p = op.value;
+        n = op.type.number;
+        for (i=0 ; i<n ; i++) {
+          Array *a = p[i]? Pointee(p[i]) : 0;
+          if (a && (a->ops==&stringOps || a->ops==&pointerOps))
+            YError("z_target: targets cannot be string or pointer arrays");
+        }
+        yzs->targ = p_malloc(sizeof(Array *)*n);
+        for (i=0 ; i<n ; i++)
+          yzs->targ[i] = p[i]? Ref((Array *)Pointee(p[i])) : 0;
+      } else {
+        if (op.owner->ops != &dataBlockSym)
+          YError("z_target: target must be an array variable");
+        n = 1;
+        yzs->targ = p_malloc(sizeof(Array *));
+        yzs->targ[0] = Ref((Array *)op.owner->value.db);
+      }
+      yzs->ntarg = n;
+    }
+  }
+  PushLongValue(yzs->tdone + yzs->toff);
+}
+
+/* drop z_target arrays */
+static void
+yz_tclear(yz_stream *yzs)
+{
+  long i;
+  if (!yzs->targ) return;
+  for (i=0 ; i<yzs->ntarg ; i++) Unref(yzs->targ[i]);
+  p_free(yzs->targ);
+  yzs->targ = 0;
+  yzs->ntarg = yzs->itarg = 0;
+  yzs->toff = yzs->tdone = 0;
+}
+
+/* return free space at z_target cursor, moving on to the next array
+ * when the current one is full, or 0 when all targets are full */
+static Bytef *
+yz_tnext(yz_stream *yzs, unsigned long *len)
+{
+  for ( ; yzs->itarg<yzs->ntarg ; yzs->itarg++) {
+    Array *a = yzs->targ[yzs->itarg];
+    unsigned long n = a? a->type.number * a->type.base->size : 0;
+    if (yzs->toff < n) {
+      *len = n - yzs->toff;
+      return (Bytef *)a->value.c + yzs->toff;
+    }
+    yzs->tdone += yzs->toff;
+    yzs->toff = 0;
+  }
+  *len = 0;
+  return 0;
+}
+
+static char *yz_crc32_knames[] = { "threads", 0 };
+static long yz_crc32_kglobs[2];
+
+void
+Y_z_crc32(int nArgs)
+{
+  Operand op;
+  Symbol *args[3], *keys[1];
+  int use_adler32, nthreads;
+  uLong cksum;
+  unsigned long ldata;
+  int n = yz_getargs(nArgs, args, 3, yz_crc32_knames, yz_crc32_kglobs,
+                     keys, "z_crc32");
+  if (n<2) YError("z_crc32 takes 2 or 3 arguments");
+  use_adler32 = (n==3 && YGetInteger(args[2])!=0);
+  if (keys[0] && YNotNil(keys[0])) {
+    long nt = YGetInteger(keys[0]);
+    if (nt<1 || nt>YZ_MAX_THREADS)
+      YError("z_crc32: threads= must be between 1 and 256");
+    nthreads = nt;
+  } else {
+    nthreads = yz_ncpu();
+  }
+  if (YNotNil(args[0]))
+    cksum = YGetInteger(args[0]);
   else
     cksum = use_adler32? adler32(0L, Z_NULL, 0) : crc32(0L, Z_NULL, 0);
-  stack++;
-  stack->ops->FormOperand(stack, &op);
+  args[1]->ops->FormOperand(args[1], &op);
   if (!op.ops->isArray)
     YError("z_crc32 input data must be an array data type");
   if (op.ops==&stringOps || op.ops==&pointerOps)
     YError("z_crc32 cannot handle string or pointer input data");
   ldata = op.type.number * op.type.base->size;
-  PushLongValue(use_adler32? adler32(cksum, op.value, ldata) :
-		crc32(cksum, op.value, ldata));
+  PushLongValue(yz_par_cksum(use_adler32, cksum, op.value, ldata, nthreads));
 }
 
 static void
 yz_do_deflate(yz_stream *yzs, Bytef *data, unsigned long ldata, int flush)
+{
+  if (yzs->filter) yz_fdeflate(yzs, data, ldata, flush);
+  else yz_zdeflate(yzs, data, ldata, flush);
+}
+
+static void
+yz_zdeflate(yz_stream *yzs, Bytef *data, unsigned long ldata, int flush)
 {
   /* compress final chunk of data, guessing factor of 4 compression */
   int flag;
-  unsigned long lguess = (ldata >> 2) + 1;
+  unsigned long lguess = (ldata >> 2) + 1, left = ldata;
+  if (yzs->codec) {
+    yz_cdeflate(yzs, data, ldata, flush);
+    return;
+  }
+  if (yzs->speed && ldata) yz_autolevel(yzs, data, ldata);
+  if (yzs->nthreads) {
+    yz_par_deflate(yzs, data, ldata, flush);
+    return;
+  }
 
+  /* slices before the last are fed with Z_NO_FLUSH, since zlib forbids
+   * adding input after a Z_FINISH or changing flush mid-block */
   yzs->zs.next_in = data;
-  yzs->zs.avail_in = ldata;
+  yzs->zs.avail_in = yz_slice(&left);
   for (;;) {
-    yzs->zs.next_out = yz_getspace(yzs, lguess);
-    yzs->zs.avail_out = yzs->chunk->avail;
-    flag = deflate(&yzs->zs, flush);
-    yzs->chunk->used += yzs->chunk->avail - yzs->zs.avail_out;
-    yzs->chunk->avail = yzs->zs.avail_out;
+    Bytef *out0 = yz_getspace(yzs, lguess);
+    unsigned long avail = yzs->out->type.number - yzs->used;
+    yzs->zs.next_out = out0;
+    yzs->zs.avail_out = yz_slice(&avail);
+    flag = deflate(&yzs->zs, left? Z_NO_FLUSH : flush);
+    yzs->used += yzs->zs.next_out - out0;
+    /* no input and nothing new to flush is not an error */
+    if (flag==Z_BUF_ERROR && flush!=Z_FINISH) flag = Z_OK;
     if (flag != Z_OK) {
       yzs->status = 0;
       deflateEnd(&yzs->zs);
@@ -548,7 +1249,10 @@ yz_do_deflate(yz_stream *yzs, Bytef *data, unsigned long ldata, int flush)
       }
       break;
     }
-    if (yzs->zs.avail_out) break;
+    if (!yzs->zs.avail_in && left)
+      yzs->zs.avail_in = yz_slice(&left);
+    else if (yzs->zs.avail_out)
+      break;
 
     /* difficult to recompute lguess here, because we don't know
      * how much is held in internal zlib state
@@ -556,21 +1260,2956 @@ yz_do_deflate(yz_stream *yzs, Bytef *data, unsigned long ldata, int flush)
   }
 }
 
+/* z_deflate speed=: Before any input is compressed, deflate up to
+ * YZ_SAMPLE bytes of the first data with each candidate level and
+ * strategy, timing each.  Keep the one producing the smallest output
+ * among those meeting the MB/s target (per thread for threads=), or
+ * the fastest if none do.  Z_RLE finds only runs, but is several times
+ * faster than level 1 and nearly as good for image-like data.  */
+#define YZ_SAMPLE 262144L
+static int yz_cands[7][2] = {
+  { 9, Z_DEFAULT_STRATEGY }, { 6, Z_DEFAULT_STRATEGY },
+  { 3, Z_DEFAULT_STRATEGY }, { 1, Z_DEFAULT_STRATEGY },
+  { 6, Z_FILTERED }, { 1, Z_RLE }, { 1, Z_HUFFMAN_ONLY } };
+
+static void
+yz_autolevel(yz_stream *yzs, Bytef *data, unsigned long ldata)
+{
+  double target = 1.0e6 * yzs->speed, rate, best_rate = 0.0;
+  unsigned long n = (ldata < YZ_SAMPLE)? ldata : YZ_SAMPLE;
+  unsigned long len = n + (n >> 3) + 1024, size, best_size = 0;
+  int i, best = -1, fastest = 0, flag;
+  Bytef *out = p_malloc(len);
+  z_stream zs;
+  yzs->speed = 0;
+  if (yzs->nthreads > 1) target /= yzs->nthreads;
+  zs.zalloc = &yz_zalloc;
+  zs.zfree = &yz_zfree;
+  zs.opaque = Z_NULL;
+  for (i=0 ; i<7 ; i++) {
+    clock_t t0 = clock();
+    if (deflateInit2(&zs, yz_cands[i][0], Z_DEFLATED, -yzs->wbits,
+                     yzs->memlevel, yz_cands[i][1]) != Z_OK) continue;
+    zs.next_in = data;
+    zs.avail_in = n;
+    zs.next_out = out;
+    zs.avail_out = len;
+    flag = deflate(&zs, Z_FINISH);
+    size = (flag==Z_STREAM_END)? len - zs.avail_out : len;
+    deflateEnd(&zs);
+    rate = (double)(clock() - t0) / CLOCKS_PER_SEC;
+    rate = n / ((rate > 1.0e-6)? rate : 1.0e-6);
+    if (rate > best_rate) best_rate = rate, fastest = i;
+    if (rate >= target && (best<0 || size<best_size))
+      best = i, best_size = size;
+  }
+  p_free(out);
+  if (best < 0) best = fastest;
+  yzs->level = yz_cands[best][0];
+  yzs->strategy = yz_cands[best][1];
+  /* legal because no input has yet been compressed */
+  if (!yzs->nthreads)
+    deflateParams(&yzs->zs, yzs->level, yzs->strategy);
+}
+
+/* The output buffer is a single 1D char array which grows geometrically
+ * (by at least a factor of 2) when less than 1024 bytes remain, so that
+ * the total copying cost of growing it is proportional to its final size.
+ * Since it is a yorick array, z_flush can return it directly when the
+ * output happens to fill it exactly; otherwise z_flush makes one bulk
+ * copy, and the buffer is reused by subsequent z_deflate or z_inflate
+ * calls.  The first allocation is exactly nbytes, and the free space
+ * is used without growing if it is at least nbytes, so that a correct
+ * guess (e.g.- z_inflate size=) costs a single allocation and no copy.  */
 static Bytef *
 yz_getspace(yz_stream *yzs, unsigned long nbytes)
 {
-  yz_block *chunk;
-  long len;
-  if (yzs->chunk && yzs->chunk->avail>=1024)
-    return (Bytef *)yzs->chunk->data + yzs->chunk->used;
-  len = (( ((nbytes-1)>>12) + 1 ) << 12);
-  chunk = p_malloc(sizeof(yz_block) + len);
-  if (!chunk) return 0;
-  chunk->prev = yzs->chunk;
-  chunk->avail = len + sizeof(long);
-  chunk->used = 0;
-  yzs->chunk = chunk;
-  return (Bytef *)chunk->data;
+  Array *out = yzs->out;
+  long len = out? out->type.number : 0;
+  if (len-yzs->used >= 1024 || (len>yzs->used && len-yzs->used >= nbytes))
+    return (Bytef *)out->value.c + yzs->used;
+  /* with file=, the buffer need only hold one write */
+  if (yzs->sink && nbytes > YZ_SINKBLK) nbytes = YZ_SINKBLK;
+  return yz_reserve(yzs, nbytes);
+}
+
+/* like yz_getspace, but guarantee at least nbytes of free space */
+static Bytef *
+yz_reserve(yz_stream *yzs, unsigned long nbytes)
+{
+  Array *out = yzs->out;
+  long len = out? out->type.number : 0;
+  if (len-yzs->used >= (long)nbytes)
+    return (Bytef *)out->value.c + yzs->used;
+  if (yzs->sink && yzs->used >= YZ_SINKBLK) {
+    /* write whole blocks to file= rather than growing buffer */
+    yz_sink_write(yzs, (yzs->used / YZ_SINKBLK) * YZ_SINKBLK);
+    out = yzs->out;
+    len = out? out->type.number : 0;
+    if (len-yzs->used >= (long)nbytes)
+      return (Bytef *)out->value.c + yzs->used;
+  }
+  if (nbytes < 1024) nbytes = 1024;
+  if (out) {
+    if (nbytes < len) nbytes = len;
+    len = (( ((yzs->used+nbytes-1)>>12) + 1 ) << 12);
+  } else {
+    len = nbytes;  /* exact size, so z_flush can hand it back */
+  }
+  yzs->out = NewArray(&charStruct, ynew_dim(len, (void*)0));
+  if (out) {
+    if (yzs->used) memcpy(yzs->out->value.c, out->value.c, yzs->used);
+    Unref(out);
+  }
+  return (Bytef *)yzs->out->value.c + yzs->used;
+}
+
+/* Guess how many bytes lzdata more bytes of compressed input will
+ * inflate to.  With a size= hint, this is whatever the hint says is
+ * still to come.  Otherwise, use the compression ratio observed so far
+ * for this stream (with a little slop), or 4 times lzdata at first.  */
+static unsigned long
+yz_inflate_guess(yz_stream *yzs, unsigned long lzdata)
+{
+  double ratio = 4.0;
+  if (yzs->lhint > yzs->zs.total_out)
+    return yzs->lhint - yzs->zs.total_out;
+  if (yzs->zs.total_in >= 1024)
+    ratio = 1.125 * (double)yzs->zs.total_out / (double)yzs->zs.total_in;
+  if (ratio < 1.0) ratio = 1.0;
+  ratio *= (double)lzdata;
+  return (ratio < 1.0e15)? (unsigned long)ratio + 1024 : 1024;
+}
+
+/* take the next slice of at most YZ_ZSLICE bytes from *left */
+static uInt
+yz_slice(unsigned long *left)
+{
+  unsigned long n = (*left > YZ_ZSLICE)? YZ_ZSLICE : *left;
+  *left -= n;
+  return (uInt)n;
+}
+
+static void
+yz_append(yz_stream *yzs, Bytef *data, unsigned long ldata)
+{
+  while (ldata) {
+    Bytef *dst = yz_getspace(yzs, ldata);
+    unsigned long n = yzs->out->type.number - yzs->used;
+    if (n > ldata) n = ldata;
+    memcpy(dst, data, n);
+    yzs->used += n;
+    data += n;
+    ldata -= n;
+  }
+}
+
+/* return YZ_CZLIB, YZ_CZSTD, or YZ_CLZ4 for codec= keyword, YZ_CZLIB if
+ * the keyword is missing */
+static int
+yz_getcodec(Symbol *key, char *fname)
+{
+  char *name, msg[96];
+  int i;
+  if (!key || !YNotNil(key)) return YZ_CZLIB;
+  name = YGetString(key);
+  for (i=0 ; yz_cnames[i] ; i++)
+    if (name && !strcmp(name, yz_cnames[i])) break;
+  if (!yz_cnames[i]) {
+    sprintf(msg, "%.20s: codec= must be \"zlib\", \"zstd\", or \"lz4\"", fname);
+    YError(msg);
+  }
+  return i;
+}
+
+/* return filter bits for filter= keyword, 0 if missing, setting *elsize
+ * from the elsize= keyword, 0 if missing */
+static int
+yz_getfilter(Symbol *key, Symbol *ekey, long *elsize)
+{
+  char *name;
+  int i;
+  *elsize = 0;
+  if (ekey && YNotNil(ekey)) {
+    *elsize = YGetInteger(ekey);
+    if (*elsize<1 || *elsize>255)
+      YError("z_deflate: elsize= must be between 1 and 255");
+  }
+  if (!key || !YNotNil(key)) return 0;
+  name = YGetString(key);
+  for (i=0 ; yz_flnames[i] ; i++)
+    if (name && !strcmp(name, yz_flnames[i])) break;
+  if (!yz_flnames[i])
+    YError("z_deflate: filter= must be \"shuffle\", \"bitshuffle\", "
+           "\"delta\", \"delta+shuffle\", \"delta+bitshuffle\", or \"none\"");
+  return i;
+}
+
+/* Keyword arguments appear on the stack as a Symbol with ops==0 whose
+ * index is the global index of the keyword name, followed by the keyword
+ * value.  Sort the nArgs arguments on the stack into positional args
+ * (returning their number) and keys[i] for knames[i] (0 if missing).
+ * As for yarg_kw_init in yapi.h, kglobs has one more element than the
+ * 0-terminated knames, and kglobs[0]==0 until the first call.  */
+static int
+yz_getargs(int nArgs, Symbol **args, int maxArgs, char **knames,
+           long *kglobs, Symbol **keys, char *fname)
+{
+  Symbol *stack = sp - nArgs + 1;
+  int i, n = 0;
+  char msg[96];
+  if (!kglobs[0]) {
+    for (i=0 ; knames[i] ; i++) kglobs[i+1] = Globalize(knames[i], 0L);
+    kglobs[0] = 1;
+  }
+  for (i=0 ; knames[i] ; i++) keys[i] = 0;
+  for ( ; stack<=sp ; stack++) {
+    if (!stack->ops) {
+      for (i=0 ; knames[i] && kglobs[i+1]!=stack->index ; i++);
+      if (!knames[i]) {
+        sprintf(msg, "%.20s: unrecognized keyword %.40s", fname,
+                globalTable.names[stack->index]);
+        YError(msg);
+      }
+      keys[i] = ++stack;
+    } else {
+      if (n >= maxArgs) {
+        sprintf(msg, "%.20s takes at most %d arguments", fname, maxArgs);
+        YError(msg);
+      }
+      args[n++] = stack;
+    }
+  }
+  return n;
+}
+
+/* return YZ_ZLIB, YZ_GZIP, YZ_RAW, or (inflate only) YZ_AUTO for format=
+ * keyword, YZ_ZLIB if the keyword is missing */
+static int
+yz_getformat(Symbol *key, int inflate, char *fname)
+{
+  char *name, msg[96];
+  int i;
+  if (!key || !YNotNil(key)) return YZ_ZLIB;
+  name = YGetString(key);
+  for (i=0 ; yz_fnames[i] ; i++)
+    if (name && !strcmp(name, yz_fnames[i])) break;
+  if (!yz_fnames[i] || (i==YZ_AUTO && !inflate)) {
+    sprintf(msg, "%.20s: format= must be \"zlib\", \"gzip\", \"raw\"%s",
+            fname, inflate? ", or \"auto\"" : "");
+    YError(msg);
+  }
+  return i;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/* Output file for z_deflate (file=): Whenever the output buffer would
+ * otherwise grow, yz_reserve writes all complete YZ_SINKBLK blocks it
+ * holds to the file, so the buffer stays a few YZ_SINKBLK long no matter
+ * how much is compressed, and every write but the last is a whole number
+ * of blocks at a block-aligned offset.  With writer=1 (and pthreads),
+ * the full buffer is handed to a background thread, and compression
+ * continues into a fresh buffer while the previous one is written.  */
+
+static void yz_sink_wait(yz_sink *sink);
+#ifdef YZ_PTHREAD
+static void *yz_sink_work(void *sinkv);
+#endif
+
+static yz_sink *
+yz_sink_open(char *name, int writer)
+{
+  char *native = p_native(name);
+  FILE *f = fopen(native, "wb");
+  yz_sink *sink;
+  p_free(native);
+  if (!f) YError("z_deflate: unable to create file= file");
+  /* writes are already large, stdio buffering would only add a copy */
+  setvbuf(f, 0, _IONBF, 0);
+  sink = p_malloc(sizeof(yz_sink));
+  sink->f = f;
+  sink->nwritten = 0;
+  sink->writer = writer;
+  sink->error = 0;
+  sink->buf = 0;
+  sink->nbuf = 0;
+#ifdef YZ_PTHREAD
+  sink->busy = 0;
+#else
+  sink->writer = 0;
+#endif
+  return sink;
+}
+
+/* write first nbytes of output buffer to file=, keep any remainder */
+static void
+yz_sink_write(yz_stream *yzs, long nbytes)
+{
+  yz_sink *sink = yzs->sink;
+  Array *out = yzs->out;
+  long rest = yzs->used - nbytes;
+  if (nbytes <= 0) return;
+  yz_sink_wait(sink);
+  sink->nwritten += nbytes;
+#ifdef YZ_PTHREAD
+  if (sink->writer) {
+    sink->buf = out;
+    sink->nbuf = nbytes;
+    yzs->out = NewArray(&charStruct, ynew_dim(out->type.number, (void*)0));
+    if (rest) memcpy(yzs->out->value.c, out->value.c+nbytes, rest);
+    yzs->used = rest;
+    if (!pthread_create(&sink->thread, 0, &yz_sink_work, sink))
+      sink->busy = 1;
+    else
+      yz_sink_work(sink);
+    return;
+  }
+#endif
+  if (fwrite(out->value.c, 1, nbytes, sink->f) != (size_t)nbytes)
+    sink->error = 1;
+  if (rest) memmove(out->value.c, out->value.c+nbytes, rest);
+  yzs->used = rest;
+  yz_sink_wait(sink);
+}
+
+/* wait for writer thread, raise error if any write failed */
+static void
+yz_sink_wait(yz_sink *sink)
+{
+#ifdef YZ_PTHREAD
+  if (sink->busy) pthread_join(sink->thread, 0);
+  sink->busy = 0;
+#endif
+  if (sink->buf) Unref(sink->buf);
+  sink->buf = 0;
+  if (sink->error) {
+    sink->error = 0;
+    YError("z_deflate: error writing file= file (disk full?)");
+  }
+}
+
+#ifdef YZ_PTHREAD
+/* runs in writer thread: no yorick calls */
+static void *
+yz_sink_work(void *sinkv)
+{
+  yz_sink *sink = sinkv;
+  if (fwrite(sink->buf->value.c, 1, sink->nbuf, sink->f) != (size_t)sink->nbuf)
+    sink->error = 1;
+  return 0;
+}
+#endif
+
+/* z_flush: write everything buffered, close file if stream finished */
+static long
+yz_sink_flush(yz_stream *yzs)
+{
+  yz_sink *sink = yzs->sink;
+  unsigned long nwritten;
+  yz_sink_write(yzs, yzs->used);
+  yz_sink_wait(sink);
+  nwritten = sink->nwritten;
+  if (yzs->status == 1) {
+    /* z_flush sync=, make output visible to readers now */
+    if (fflush(sink->f)) YError("z_flush: error writing file= file");
+  } else {
+    yzs->sink = 0;
+    yzs->nflushed += nwritten;
+    yz_sink_close(sink, 1);
+    Unref(yzs->out);
+    yzs->out = 0;
+  }
+  return nwritten;
+}
+
+static void
+yz_sink_close(yz_sink *sink, int check)
+{
+  int err;
+#ifdef YZ_PTHREAD
+  if (sink->busy) pthread_join(sink->thread, 0);
+  sink->busy = 0;
+#endif
+  if (sink->buf) Unref(sink->buf);
+  err = sink->error | fclose(sink->f);
+  p_free(sink);
+  if (err && check) YError("z_flush: error writing or closing file= file");
 }
 
 /*--------------------------------------------------------------------------*/
+
+/* Block-parallel deflate (z_deflate threads=), as in Mark Adler's pigz:
+ * The input is split into YZ_PBLOCK byte blocks, each compressed as raw
+ * deflate data by an independent z_stream primed with the preceding 32k
+ * of input as its dictionary.  Every block but the last ends with a sync
+ * flush, so the compressed blocks are byte aligned and can simply be
+ * concatenated.  The zlib header and adler32 trailer are written here,
+ * the adler32 being assembled from the per-block checksums with
+ * adler32_combine.  The result is an ordinary zlib stream, and since the
+ * block boundaries do not depend on the number of threads, neither does
+ * the compressed output.  Input is held in yzs->pend until a full block
+ * is available, the stream is finished, or z_flush sync= forces out a
+ * short block.  */
+
+#define YZ_PBLOCK 131072L
+#define YZ_WINDOW 32768L
+
+struct yz_pjob {
+  Bytef *in, *dict;      /* input block and preceding 32k dictionary */
+  uInt lin, ldict;
+  int level, last;       /* last set for block with final flush */
+  int strategy, memlevel;
+  int gzip;              /* check is crc32 instead of adler32 */
+  Bytef *out;            /* compressed output, malloc */
+  uLong lout, check;
+  int flag;              /* Z_OK or zlib error */
+};
+
+static void yz_pjob_run(void *jobs, long i);
+static void yz_run(int nthreads, long njobs,
+                   void (*work)(void *, long), void *arg);
+
+static int
+yz_par_init(yz_stream *yzs)
+{
+  long njobs = 4*yzs->nthreads;
+  yzs->pend = p_malloc(YZ_PBLOCK);
+  yzs->window = p_malloc(YZ_WINDOW);
+  yzs->jobs = p_malloc(sizeof(yz_pjob)*njobs);
+  if (!yzs->pend || !yzs->window || !yzs->jobs) return Z_MEM_ERROR;
+  return Z_OK;
+}
+
+static void
+yz_par_free(yz_stream *yzs)
+{
+  if (yzs->pend) p_free(yzs->pend);
+  if (yzs->window) p_free(yzs->window);
+  if (yzs->jobs) p_free(yzs->jobs);
+  yzs->pend = yzs->window = 0;
+  yzs->jobs = 0;
+}
+
+static void
+yz_par_header(yz_stream *yzs, Bytef *dict, long ldict)
+{
+  Byte hdr[10];
+  int level = yzs->level, n = 2;
+  uLong check;
+  if (level == Z_DEFAULT_COMPRESSION) level = 6;
+  if (yzs->format == YZ_GZIP) {
+    /* no file name, no mtime, same XFL and OS as zlib gzip header */
+    memset(hdr, 0, 10);
+    hdr[0] = 0x1f;
+    hdr[1] = 0x8b;
+    hdr[2] = Z_DEFLATED;
+    hdr[8] = (level==9)? 2 : (level<2)? 4 : 0;
+    hdr[9] = 3;     /* unix */
+    yz_append(yzs, hdr, 10);
+    return;
+  } else if (yzs->format == YZ_RAW) {
+    return;
+  }
+  hdr[0] = 0x78;    /* deflate, 32k window */
+  hdr[1] = (level<2)? 0 : (level<6)? 0x40 : (level==6)? 0x80 : 0xc0;
+  if (dict) {
+    yzs->adler = adler32(adler32(0L, Z_NULL, 0), dict, ldict);
+    yzs->need_dict = 1;
+    hdr[1] |= 0x20;
+    hdr[2] = (Byte)(yzs->adler >> 24);
+    hdr[3] = (Byte)(yzs->adler >> 16);
+    hdr[4] = (Byte)(yzs->adler >> 8);
+    hdr[5] = (Byte)yzs->adler;
+    n = 6;
+    /* first block is primed with final 32k of dictionary */
+    if (ldict > YZ_WINDOW) dict += ldict-YZ_WINDOW, ldict = YZ_WINDOW;
+    memcpy(yzs->window, dict, ldict);
+    yzs->nwindow = ldict;
+  }
+  check = (((uLong)hdr[0])<<8) | hdr[1];
+  hdr[1] += 31 - (check % 31);
+  yz_append(yzs, hdr, n);
+}
+
+static void
+yz_par_deflate(yz_stream *yzs, Bytef *data, unsigned long ldata, int flush)
+{
+  int final = (flush == Z_FINISH);
+  int sync = (flush==Z_SYNC_FLUSH || flush==Z_FULL_FLUSH);
+  long njobs, maxjobs = 4*yzs->nthreads, i;
+  yz_pjob *jobs = yzs->jobs;
+  Bytef *dict;
+  uInt ldict;
+
+  for (;;) {
+    njobs = 0;
+    dict = yzs->window;
+    ldict = yzs->nwindow;
+
+    if (yzs->npend) {
+      /* first block consists of pending input, if any */
+      unsigned long n = YZ_PBLOCK - yzs->npend;
+      if (n > ldata) n = ldata;
+      if (n) memcpy(yzs->pend+yzs->npend, data, n);
+      yzs->npend += n;
+      data += n;
+      ldata -= n;
+      if (yzs->npend<YZ_PBLOCK && !final && !sync) return;
+      jobs[0].in = yzs->pend;
+      jobs[0].lin = yzs->npend;
+      njobs = 1;
+    }
+    while (njobs<maxjobs && (ldata>=YZ_PBLOCK ||
+                             (final && (ldata || !njobs)) || (sync && ldata))) {
+      jobs[njobs].in = data;
+      jobs[njobs].lin = (ldata<YZ_PBLOCK)? ldata : YZ_PBLOCK;
+      data += jobs[njobs].lin;
+      ldata -= jobs[njobs].lin;
+      njobs++;
+    }
+    if (!njobs) break;
+
+    for (i=0 ; i<njobs ; i++) {
+      jobs[i].dict = dict;
+      jobs[i].ldict = ldict;
+      jobs[i].level = yzs->level;
+      jobs[i].strategy = yzs->strategy;
+      jobs[i].memlevel = yzs->memlevel;
+      jobs[i].last = 0;
+      jobs[i].gzip = yzs->gzip;
+      jobs[i].out = 0;
+      /* every block but the last is at least YZ_WINDOW long */
+      dict = jobs[i].in + jobs[i].lin - YZ_WINDOW;
+      ldict = YZ_WINDOW;
+    }
+    if (final && !ldata) jobs[njobs-1].last = 1;
+
+    yz_run(yzs->nthreads, njobs, &yz_pjob_run, jobs);
+
+    for (i=0 ; i<njobs ; i++) if (jobs[i].flag != Z_OK) break;
+    if (i < njobs) {
+      int flag = jobs[i].flag;
+      for (i=0 ; i<njobs ; i++) if (jobs[i].out) free(jobs[i].out);
+      yzs->status = 0;
+      if (flag == Z_MEM_ERROR)
+        YError("z_deflate: memory error in parallel deflate");
+      else
+        YError("z_deflate: zlib error during parallel deflate");
+    }
+    for (i=0 ; i<njobs ; i++) {
+      yz_append(yzs, jobs[i].out, jobs[i].lout);
+      free(jobs[i].out);
+      jobs[i].out = 0;
+      yzs->check = yzs->gzip?
+        crc32_combine(yzs->check, jobs[i].check, jobs[i].lin) :
+        adler32_combine(yzs->check, jobs[i].check, jobs[i].lin);
+      yzs->nin += jobs[i].lin;
+    }
+    i = njobs - 1;
+    if (jobs[i].lin >= YZ_WINDOW) {
+      memcpy(yzs->window, jobs[i].in+jobs[i].lin-YZ_WINDOW, YZ_WINDOW);
+      yzs->nwindow = YZ_WINDOW;
+    } else if (jobs[i].lin) {
+      /* short block forced out by sync=, append it to its dictionary */
+      uInt keep = YZ_WINDOW - jobs[i].lin;
+      if (keep > jobs[i].ldict) keep = jobs[i].ldict;
+      memmove(yzs->window, jobs[i].dict+jobs[i].ldict-keep, keep);
+      memcpy(yzs->window+keep, jobs[i].in, jobs[i].lin);
+      yzs->nwindow = keep + jobs[i].lin;
+    }
+    yzs->npend = 0;
+
+    if (jobs[i].last) {
+      Byte trailer[8];
+      if (yzs->format == YZ_ZLIB) {
+        trailer[0] = (Byte)(yzs->check >> 24);
+        trailer[1] = (Byte)(yzs->check >> 16);
+        trailer[2] = (Byte)(yzs->check >> 8);
+        trailer[3] = (Byte)yzs->check;
+        yz_append(yzs, trailer, 4);
+      } else if (yzs->format == YZ_GZIP) {
+        /* crc32 and input length, both little endian */
+        for (i=0 ; i<4 ; i++) {
+          trailer[i] = (Byte)(yzs->check >> (8*i));
+          trailer[4+i] = (Byte)(yzs->nin >> (8*i));
+        }
+        yz_append(yzs, trailer, 8);
+      }
+      yzs->status = 0;
+      break;
+    }
+  }
+
+  if (ldata) {
+    /* hold partial block until more input arrives */
+    memcpy(yzs->pend, data, ldata);
+    yzs->npend = ldata;
+  }
+  /* after a full flush, the next block starts with no dictionary */
+  if (flush == Z_FULL_FLUSH) yzs->nwindow = 0;
+}
+
+/* runs in worker thread: no yorick calls, no p_malloc */
+static void
+yz_pjob_run(void *jobs, long i)
+{
+  yz_pjob *job = (yz_pjob *)jobs + i;
+  z_stream zs;
+  int flag;
+  zs.zalloc = &yz_zalloc;
+  zs.zfree = &yz_zfree;
+  zs.opaque = Z_NULL;
+  job->check = job->gzip? crc32(crc32(0L, Z_NULL, 0), job->in, job->lin) :
+    adler32(adler32(0L, Z_NULL, 0), job->in, job->lin);
+  job->lout = 0;
+  flag = deflateInit2(&zs, job->level, Z_DEFLATED, -MAX_WBITS,
+                      job->memlevel, job->strategy);
+  if (flag == Z_OK) {
+    /* allow for the 4-5 byte empty stored block of the sync flush */
+    uLong len = deflateBound(&zs, job->lin) + 16;
+    job->out = malloc(len);
+    if (!job->out) flag = Z_MEM_ERROR;
+    else if (job->ldict)
+      flag = deflateSetDictionary(&zs, job->dict, job->ldict);
+    if (flag == Z_OK) {
+      zs.next_in = job->in;
+      zs.avail_in = job->lin;
+      zs.next_out = job->out;
+      zs.avail_out = len;
+      flag = deflate(&zs, job->last? Z_FINISH : Z_SYNC_FLUSH);
+      job->lout = len - zs.avail_out;
+      if (job->last) flag = (flag==Z_STREAM_END)? Z_OK : Z_BUF_ERROR;
+      else if (flag==Z_OK && (zs.avail_in || !zs.avail_out)) flag = Z_BUF_ERROR;
+    }
+    deflateEnd(&zs);
+  }
+  job->flag = flag;
+}
+
+#ifdef YZ_PTHREAD
+typedef struct yz_team yz_team;
+struct yz_team {
+  pthread_mutex_t lock;
+  long next, njobs;
+  void (*work)(void *, long);
+  void *arg;
+};
+
+static void *
+yz_team_work(void *teamv)
+{
+  yz_team *team = teamv;
+  long i;
+  for (;;) {
+    pthread_mutex_lock(&team->lock);
+    i = team->next++;
+    pthread_mutex_unlock(&team->lock);
+    if (i >= team->njobs) break;
+    team->work(team->arg, i);
+  }
+  return 0;
+}
+#endif
+
+/* call work(arg, i) for i=0,...,njobs-1 using up to nthreads threads,
+ * the calling thread being one of them, and return when all are done */
+static void
+yz_run(int nthreads, long njobs, void (*work)(void *, long), void *arg)
+{
+  long i;
+#ifdef YZ_PTHREAD
+  if (nthreads>1 && njobs>1) {
+    pthread_t tid[YZ_MAX_THREADS];
+    yz_team team;
+    int n;
+    if (nthreads > njobs) nthreads = njobs;
+    pthread_mutex_init(&team.lock, 0);
+    team.next = 0;
+    team.njobs = njobs;
+    team.work = work;
+    team.arg = arg;
+    for (n=0 ; n<nthreads-1 ; n++)
+      if (pthread_create(tid+n, 0, &yz_team_work, &team)) break;
+    yz_team_work(&team);
+    for (i=0 ; i<n ; i++) pthread_join(tid[i], 0);
+    pthread_mutex_destroy(&team.lock);
+    return;
+  }
+#endif
+  for (i=0 ; i<njobs ; i++) work(arg, i);
+}
+
+/* number of threads to use by default, one per processor */
+static int
+yz_ncpu(void)
+{
+#if defined(YZ_PTHREAD) && defined(_SC_NPROCESSORS_ONLN)
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n > YZ_MAX_THREADS) n = YZ_MAX_THREADS;
+  return (n>1)? (int)n : 1;
+#else
+  return 1;
+#endif
+}
+
+/*--------------------------------------------------------------------------*/
+
+/* Parallel checksums (z_crc32):
+ * Arrays of at least 2*YZ_CKBLOCK bytes are cut into one piece per
+ * thread, each piece checksummed from scratch, and the partial results
+ * merged in order with crc32_combine or adler32_combine, which cost
+ * only O(log(length)).  The checksum kernel itself is zlib's, which
+ * since zlib 1.2.12 processes several words at a time.  Each zlib call
+ * is limited to one yz_slice, since the length is a uInt.  */
+
+#define YZ_CKBLOCK 4194304L
+
+typedef struct yz_ckjob yz_ckjob;
+struct yz_ckjob {
+  Bytef *data;
+  unsigned long ldata;
+  uLong cksum;
+  int use_adler32;
+};
+
+static uLong
+yz_cksum(int use_adler32, uLong cksum, Bytef *data, unsigned long ldata)
+{
+  uInt n;
+  while (ldata) {
+    n = yz_slice(&ldata);
+    cksum = use_adler32? adler32(cksum, data, n) : crc32(cksum, data, n);
+    data += n;
+  }
+  return cksum;
+}
+
+static void
+yz_ckjob_run(void *jobs, long i)
+{
+  yz_ckjob *job = (yz_ckjob *)jobs + i;
+  job->cksum = yz_cksum(job->use_adler32,
+                        job->use_adler32? adler32(0L, Z_NULL, 0) :
+                        crc32(0L, Z_NULL, 0), job->data, job->ldata);
+}
+
+static uLong
+yz_par_cksum(int use_adler32, uLong cksum,
+             Bytef *data, unsigned long ldata, int nthreads)
+{
+  yz_ckjob jobs[YZ_MAX_THREADS];
+  unsigned long lpiece;
+  long i, njobs = ldata / YZ_CKBLOCK;
+  if (njobs > nthreads) njobs = nthreads;
+  if (njobs < 2) return yz_cksum(use_adler32, cksum, data, ldata);
+  lpiece = ldata / njobs;
+  for (i=0 ; i<njobs ; i++) {
+    jobs[i].data = data;
+    jobs[i].ldata = (i<njobs-1)? lpiece : ldata;
+    jobs[i].use_adler32 = use_adler32;
+    data += lpiece;
+    ldata -= lpiece;
+  }
+  yz_run(nthreads, njobs, &yz_ckjob_run, jobs);
+  for (i=0 ; i<njobs ; i++)
+    cksum = use_adler32?
+      adler32_combine(cksum, jobs[i].cksum, (z_off_t)jobs[i].ldata) :
+      crc32_combine(cksum, jobs[i].cksum, (z_off_t)jobs[i].ldata);
+  return cksum;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/* One-shot (de)compression:
+ * z_flush(z_deflate(), data) and z_inflate(z_inflate(), zdata, data)
+ * know all their input (and for z_inflate, where the output goes) in a
+ * single call.  With libdeflate, which compresses and decompresses a
+ * whole buffer at once, typically 2-3 times faster than zlib streaming,
+ * these are handed to libdeflate instead of the z_stream loop.  The
+ * result is still an ordinary zlib (gzip, raw) stream, although not
+ * byte for byte the same as zlib would produce, so z_deflate_batch uses
+ * libdeflate too.  Without libdeflate, one-shot z_flush at least
+ * reserves deflateBound space, so the output buffer is never regrown.
+ * libdeflate decompression fails unless the whole stream fits in data,
+ * in which case z_inflate falls back to zlib, which starts over.
+ * Output not written to a data array lands in the stream buffer, which
+ * z_flush hands back without a copy only when it is exactly full: for
+ * z_inflate with a correct size=, but almost never for z_deflate, whose
+ * buffer is sized to the compress bound.  The extra copy of compressed
+ * output costs well under 1% of the libdeflate compression time.  */
+
+#ifdef YZ_LIBDEFLATE
+static struct libdeflate_compressor *yz_ldc = 0;
+static int yz_ldlevel = 0;
+static struct libdeflate_decompressor *yz_ldd = 0;
+
+/* get compressor for zlib level, reusing *c if the level matches */
+static struct libdeflate_compressor *
+yz_ldget(struct libdeflate_compressor **c, int *clevel, int level)
+{
+  if (level == Z_DEFAULT_COMPRESSION) level = 6;
+  if (*c && *clevel==level) return *c;
+  if (*c) libdeflate_free_compressor(*c);
+  *c = libdeflate_alloc_compressor(level);
+  *clevel = level;
+  return *c;
+}
+
+static size_t
+yz_ldbound(struct libdeflate_compressor *c, int format, size_t lin)
+{
+  if (format == YZ_GZIP) return libdeflate_gzip_compress_bound(c, lin);
+  if (format == YZ_RAW) return libdeflate_deflate_compress_bound(c, lin);
+  return libdeflate_zlib_compress_bound(c, lin);
+}
+
+/* returns compressed length, 0 on failure */
+static size_t
+yz_ldcompress(struct libdeflate_compressor *c, int format,
+              Bytef *in, size_t lin, Bytef *out, size_t lout)
+{
+  if (format == YZ_GZIP)
+    return libdeflate_gzip_compress(c, in, lin, out, lout);
+  if (format == YZ_RAW)
+    return libdeflate_deflate_compress(c, in, lin, out, lout);
+  return libdeflate_zlib_compress(c, in, lin, out, lout);
+}
+#endif
+
+/* true if the final z_flush is also the first z_deflate input */
+static int
+yz_oneshot(yz_stream *yzs)
+{
+  return !yzs->zs.total_in && !yzs->used && !yzs->codec &&
+    !yzs->nthreads && !yzs->filter && !yzs->sink;
+}
+
+static void
+yz_odeflate(yz_stream *yzs, Bytef *data, unsigned long ldata)
+{
+#ifdef YZ_LIBDEFLATE
+  if (!yzs->need_dict && !yzs->speed && yzs->strategy==Z_DEFAULT_STRATEGY &&
+      yzs->memlevel==8 && yzs->wbits==MAX_WBITS) {
+    struct libdeflate_compressor *c = yz_ldget(&yz_ldc, &yz_ldlevel,
+                                               yzs->level);
+    if (c) {
+      size_t bound = yz_ldbound(c, yzs->format, ldata);
+      size_t n = yz_ldcompress(c, yzs->format, data, ldata,
+                               yz_reserve(yzs, bound), bound);
+      if (n) {
+        yzs->used += n;
+        yzs->zs.total_in += ldata;
+        yzs->zs.total_out += n;
+        yzs->status = 0;
+        deflateEnd(&yzs->zs);
+        return;
+      }
+    }
+  }
+#endif
+  yz_reserve(yzs, deflateBound(&yzs->zs, ldata));
+  yz_do_deflate(yzs, data, ldata, Z_FINISH);
+}
+
+/* Decompress all of zdata into data, or into the buffer if size= was
+ * given and data was not.  Returns the z_inflate flag, or -3 if zlib
+ * must do the work.  */
+static int
+yz_oinflate(yz_stream *yzs, Bytef *zdata, unsigned long lzdata,
+            Bytef *data, unsigned long ldata, unsigned long *ndata)
+{
+#ifdef YZ_LIBDEFLATE
+  size_t nin, nout;
+  enum libdeflate_result r;
+  Bytef *out = data;
+  if (yzs->zs.total_in || yzs->need_dict || yzs->dict || lzdata<2 ||
+      yzs->format==YZ_AUTO || (!data && !yzs->lhint) ||
+      (yzs->format==YZ_ZLIB && (zdata[1]&0x20)))  /* preset dictionary */
+    return -3;
+  if (!yz_ldd) yz_ldd = libdeflate_alloc_decompressor();
+  if (!yz_ldd) return -3;
+  if (!out) {
+    ldata = yzs->lhint;
+    out = yz_reserve(yzs, ldata);
+  }
+  if (yzs->format == YZ_GZIP)
+    r = libdeflate_gzip_decompress_ex(yz_ldd, zdata, lzdata, out, ldata,
+                                      &nin, &nout);
+  else if (yzs->format == YZ_RAW)
+    r = libdeflate_deflate_decompress_ex(yz_ldd, zdata, lzdata, out, ldata,
+                                         &nin, &nout);
+  else
+    r = libdeflate_zlib_decompress_ex(yz_ldd, zdata, lzdata, out, ldata,
+                                      &nin, &nout);
+  /* further gzip members are left to zlib */
+  if (r!=LIBDEFLATE_SUCCESS || (yzs->gzip && nin<lzdata)) return -3;
+  if (data) *ndata = nout;
+  else yzs->used += nout;
+  yzs->zs.total_in += nin;
+  yzs->zs.total_out += nout;
+  if (yzs->gzip) return 0;  /* buffer remains open for another member */
+  yzs->status = 0;
+  inflateEnd(&yzs->zs);
+  yzs->status = 3;
+  return (nin < lzdata)? -1 : 0;
+#else
+  return -3;
+#endif
+}
+
+/*--------------------------------------------------------------------------*/
+
+/* Batched compression (z_deflate_batch, z_inflate_batch):
+ * A pointer array of small inputs is (de)compressed item by item, each
+ * item an independent complete stream.  Worker j handles items j, j+n,
+ * j+2n, ... with the z_stream in yz_bpool[j], which survives from one
+ * call to the next, so that deflateInit (with its 256k of zlib state)
+ * happens once per worker rather than once per item: between items the
+ * stream is merely reset with deflateReset or inflateReset2.  A stream
+ * is reinitialized only when the level or format changes.  Workers make
+ * no yorick calls, so their output goes to malloc buffers, which are
+ * copied into yorick arrays afterwards.  */
+
+typedef struct yz_bstream yz_bstream;
+struct yz_bstream {
+  z_stream zs;
+  int kind;            /* 0 uninitialized, 1 deflate, 2 inflate */
+  int level, wbits;    /* deflate parameters zs was initialized with */
+#ifdef YZ_LIBDEFLATE
+  struct libdeflate_compressor *ldc;  /* replaces zs for deflate */
+  int ldlevel;
+#endif
+};
+static yz_bstream yz_bpool[YZ_MAX_THREADS];
+
+/* release the zlib state held by batch workers, see z_pool */
+static void
+yz_bpool_free(void)
+{
+  int j;
+  for (j=0 ; j<YZ_MAX_THREADS ; j++) {
+    yz_bstream *bs = yz_bpool + j;
+    if (bs->kind == 1) deflateEnd(&bs->zs);
+    else if (bs->kind == 2) inflateEnd(&bs->zs);
+    bs->kind = 0;
+#ifdef YZ_LIBDEFLATE
+    if (bs->ldc) libdeflate_free_compressor(bs->ldc);
+    bs->ldc = 0;
+#endif
+  }
+}
+
+typedef struct yz_batch yz_batch;
+struct yz_batch {
+  long n, nworkers;
+  int inflate, level, format;
+  Bytef **in;          /* item inputs, 0 for nil */
+  unsigned long *lin;
+  Bytef **out;         /* item outputs, malloc, 0 for nil */
+  unsigned long *lout;
+  int *flag;           /* Z_OK or zlib error for each item */
+};
+
+static void yz_batch_run(void *batch, long j);
+static void yz_batch_item(yz_bstream *bs, yz_batch *b, long k);
+static void yz_batch_go(int inflate, int nArgs, char *fname);
+
+static char *yz_batch_knames[] = { "level", "threads", "format", 0 };
+static long yz_batch_kglobs[4];
+
+void
+Y_z_deflate_batch(int nArgs)
+{
+  yz_batch_go(0, nArgs, "z_deflate_batch");
+}
+
+void
+Y_z_inflate_batch(int nArgs)
+{
+  yz_batch_go(1, nArgs, "z_inflate_batch");
+}
+
+static void
+yz_batch_go(int inflate, int nArgs, char *fname)
+{
+  Symbol *args[1], *keys[3];
+  Operand op;
+  Array *result;
+  yz_batch b;
+  void **list;
+  long k, nthreads = 1;
+  char msg[96];
+  double cpu0 = p_cpu_secs((double *)0), *g = yz_gstats[inflate];
+  if (yz_getargs(nArgs, args, 1, yz_batch_knames, yz_batch_kglobs,
+                 keys, fname) != 1) {
+    sprintf(msg, "%.20s takes exactly 1 argument", fname);
+    YError(msg);
+  }
+  b.level = Z_DEFAULT_COMPRESSION;
+  if (keys[0] && YNotNil(keys[0])) {
+    if (inflate) YError("z_inflate_batch: level= only allowed for deflate");
+    b.level = (int)YGetInteger(keys[0]);
+    if (b.level<Z_DEFAULT_COMPRESSION || b.level>Z_BEST_COMPRESSION)
+      YError("z_deflate_batch: invalid compression level");
+  }
+  if (keys[1] && YNotNil(keys[1])) {
+    nthreads = YGetInteger(keys[1]);
+    if (nthreads<1 || nthreads>YZ_MAX_THREADS) {
+      sprintf(msg, "%.20s: threads= must be between 1 and 256", fname);
+      YError(msg);
+    }
+  }
+  b.format = yz_getformat(keys[2], inflate, fname);
+  b.inflate = inflate;
+
+  args[0]->ops->FormOperand(args[0], &op);
+  if (op.ops != &pointerOps) {
+    sprintf(msg, "%.20s: argument must be an array of pointers", fname);
+    YError(msg);
+  }
+  list = op.value;
+  b.n = op.type.number;
+  result = (Array *)PushDataBlock(NewArray(&pointerStruct, op.type.dims));
+  b.in = p_malloc(b.n * (2*sizeof(Bytef *) + 2*sizeof(unsigned long) +
+                         sizeof(int)));
+  b.out = b.in + b.n;
+  b.lin = (unsigned long *)(b.out + b.n);
+  b.lout = b.lin + b.n;
+  b.flag = (int *)(b.lout + b.n);
+  for (k=0 ; k<b.n ; k++) {
+    Array *a = list[k]? Pointee(list[k]) : 0;
+    b.in[k] = b.out[k] = 0;
+    b.lin[k] = b.lout[k] = 0;
+    b.flag[k] = Z_OK;
+    if (!a) continue;
+    if (a->ops==&stringOps || a->ops==&pointerOps ||
+        (inflate && a->ops!=&charOps)) {
+      p_free(b.in);
+      sprintf(msg, "%.20s: item %ld is not a %s array", fname, k+1,
+              inflate? "char" : "numeric");
+      YError(msg);
+    }
+    b.in[k] = (Bytef *)a->value.c;
+    b.lin[k] = a->type.number * a->type.base->size;
+  }
+
+  b.nworkers = (nthreads < b.n)? nthreads : b.n;
+  if (b.nworkers > 0)
+    yz_run((int)b.nworkers, b.nworkers, &yz_batch_run, &b);
+
+  for (k=0 ; k<b.n ; k++) if (b.flag[k] != Z_OK) break;
+  if (k < b.n) {
+    int flag = b.flag[k];
+    if (flag == Z_MEM_ERROR)
+      sprintf(msg, "%.20s: memory error", fname);
+    else if (!inflate)
+      sprintf(msg, "%.20s: zlib error during deflate", fname);
+    else if (flag == Z_NEED_DICT)
+      sprintf(msg, "%.20s: item %ld requires a dictionary", fname, k+1);
+    else
+      sprintf(msg, "%.20s: item %ld corrupted or incomplete", fname, k+1);
+    for (k=0 ; k<b.n ; k++) if (b.out[k]) free(b.out[k]);
+    p_free(b.in);
+    YError(msg);
+  }
+  for (k=0 ; k<b.n ; k++) {
+    Array *a;
+    if (b.in[k]) {
+      /* each item counts as a buffer with one chunk */
+      g[0] += 1.0;
+      g[1] += 1.0;
+      g[2] += (double)b.lin[k];
+      g[3] += (double)b.lout[k];
+    }
+    if (!b.lout[k]) continue;  /* nil input or empty inflate output */
+    a = NewArray(&charStruct, ynew_dim(b.lout[k], (void*)0));
+    result->value.p[k] = a->value.c;
+    memcpy(a->value.c, b.out[k], b.lout[k]);
+    free(b.out[k]);
+    b.out[k] = 0;
+  }
+  for (k=0 ; k<b.n ; k++) if (b.out[k]) free(b.out[k]);
+  p_free(b.in);
+  g[4] += p_cpu_secs((double *)0) - cpu0;
+}
+
+/* runs in worker thread: no yorick calls, no p_malloc */
+static void
+yz_batch_run(void *batch, long j)
+{
+  yz_batch *b = batch;
+  yz_bstream *bs = yz_bpool + j;
+  long k;
+  for (k=j ; k<b->n ; k+=b->nworkers)
+    if (b->in[k]) yz_batch_item(bs, b, k);
+}
+
+static void
+yz_batch_item(yz_bstream *bs, yz_batch *b, long k)
+{
+  int flag, wbits = yz_wbits[b->format], kind = b->inflate? 2 : 1;
+  Bytef *in = b->in[k];
+  unsigned long lin = b->lin[k], len;
+  int gzip = (b->format==YZ_GZIP || (b->format==YZ_AUTO && lin>=2 &&
+                                     in[0]==0x1f && in[1]==0x8b));
+  if (lin > 0xffffffffUL) {
+    b->flag[k] = Z_BUF_ERROR;
+    return;
+  }
+  if (b->inflate && b->format==YZ_AUTO) {
+    /* as in z_inflate, anything without a zlib or gzip header is raw */
+    if (lin>=2 && ((in[0]==0x1f && in[1]==0x8b) || ((in[0]&0x0f)==Z_DEFLATED &&
+                                                    !(((in[0]<<8)|in[1])%31))))
+      wbits = 32+MAX_WBITS;
+    else
+      wbits = -MAX_WBITS;
+  }
+#ifdef YZ_LIBDEFLATE
+  if (kind == 1) {
+    /* same compressor as z_flush(z_deflate(level), in), see yz_odeflate */
+    struct libdeflate_compressor *c = yz_ldget(&bs->ldc, &bs->ldlevel,
+                                               b->level);
+    len = c? yz_ldbound(c, b->format, lin) : 0;
+    b->out[k] = len? malloc(len) : 0;
+    if (!b->out[k]) {
+      b->flag[k] = Z_MEM_ERROR;
+      return;
+    }
+    b->lout[k] = yz_ldcompress(c, b->format, in, lin, b->out[k], len);
+    b->flag[k] = b->lout[k]? Z_OK : Z_BUF_ERROR;
+    return;
+  }
+#endif
+
+  /* get a fresh stream, reusing the pooled zlib state when possible */
+  if (bs->kind && (bs->kind!=kind || (kind==1 && (bs->level!=b->level ||
+                                                  bs->wbits!=wbits)))) {
+    if (bs->kind == 1) deflateEnd(&bs->zs);
+    else inflateEnd(&bs->zs);
+    bs->kind = 0;
+  }
+  if (bs->kind == 1) {
+    flag = deflateReset(&bs->zs);
+  } else if (bs->kind == 2) {
+    flag = inflateReset2(&bs->zs, wbits);
+  } else {
+    bs->zs.zalloc = &yz_zalloc;
+    bs->zs.zfree = &yz_zfree;
+    bs->zs.opaque = Z_NULL;
+    bs->zs.next_in = Z_NULL;
+    bs->zs.avail_in = 0;
+    flag = (kind == 1)?
+      deflateInit2(&bs->zs, b->level, Z_DEFLATED, wbits, 8,
+                   Z_DEFAULT_STRATEGY) : inflateInit2(&bs->zs, wbits);
+    if (flag == Z_OK) {
+      bs->kind = kind;
+      bs->level = b->level;
+      bs->wbits = wbits;
+    }
+  }
+  if (flag != Z_OK) {
+    b->flag[k] = flag;
+    return;
+  }
+
+  bs->zs.next_in = in;
+  bs->zs.avail_in = lin;
+  if (kind == 1) {
+    len = deflateBound(&bs->zs, lin);
+    b->out[k] = malloc(len);
+    if (!b->out[k]) {
+      b->flag[k] = Z_MEM_ERROR;
+      return;
+    }
+    bs->zs.next_out = b->out[k];
+    bs->zs.avail_out = len;
+    flag = deflate(&bs->zs, Z_FINISH);
+    b->lout[k] = len - bs->zs.avail_out;
+    b->flag[k] = (flag == Z_STREAM_END)? Z_OK : Z_BUF_ERROR;
+
+  } else {
+    /* guess factor of 4 compression, doubling output space as needed */
+    len = 4*lin + 1024;
+    for (;;) {
+      Bytef *out = realloc(b->out[k], len);
+      if (!out || len>0xffffffffUL) {
+        b->flag[k] = Z_MEM_ERROR;
+        return;
+      }
+      b->out[k] = out;
+      bs->zs.next_out = out + b->lout[k];
+      bs->zs.avail_out = len - b->lout[k];
+      flag = inflate(&bs->zs, Z_FINISH);
+      b->lout[k] = len - bs->zs.avail_out;
+      if (flag == Z_STREAM_END) {
+        /* continue with the next gzip member, as z_inflate does */
+        if (gzip && bs->zs.avail_in>=2 && bs->zs.next_in[0]==0x1f &&
+            bs->zs.next_in[1]==0x8b && inflateReset(&bs->zs)==Z_OK)
+          continue;
+        break;
+      }
+      if (flag!=Z_BUF_ERROR && flag!=Z_OK) {
+        b->flag[k] = (flag==Z_MEM_ERROR || flag==Z_NEED_DICT)?
+          flag : Z_DATA_ERROR;
+        return;
+      }
+      if (bs->zs.avail_out) {  /* input exhausted before stream end */
+        b->flag[k] = Z_DATA_ERROR;
+        return;
+      }
+      len *= 2;
+    }
+    b->flag[k] = Z_OK;
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+/* Asynchronous deflate (z_deflate_async, z_wait):
+ * z_deflate_async holds a reference to its input array (or a copy, with
+ * copy=1) and compresses it as a single stream in a background thread,
+ * returning at once with a zlib_job object.  The worker makes no yorick
+ * calls, so its output goes to a malloc buffer, which z_wait copies into
+ * a yorick array after joining the thread.  Without YZ_PTHREAD, or if
+ * the thread cannot be started, the job runs to completion before
+ * z_deflate_async returns.  */
+
+typedef struct yz_job yz_job;
+struct yz_job {
+  int references;      /* reference counter */
+  Operations *ops;     /* virtual function table */
+  Array *in;           /* input array, held until job collected */
+  unsigned long lin;
+  int level, format;
+  Bytef *out;          /* compressed output, malloc */
+  unsigned long lout;
+  int flag;            /* Z_OK or zlib error */
+  Array *result;       /* output as char array, after z_wait */
+#ifdef YZ_PTHREAD
+  pthread_t thread;
+  int busy;            /* set while worker thread running */
+  int done;            /* set by worker when finished, under yz_jlock */
+#endif
+};
+
+static void yz_jfree(void *job);
+static UnaryOp yz_jprint;
+static void *yz_job_work(void *jobv);
+static int yz_jwait(yz_job *job, int block);
+
+Operations yz_jops = {
+  &yz_jfree, T_OPAQUE, 0, T_STRING, "zlib_job",
+  {&PromXX, &PromXX, &PromXX, &PromXX, &PromXX, &PromXX, &PromXX, &PromXX},
+  &ToAnyX, &ToAnyX, &ToAnyX, &ToAnyX, &ToAnyX, &ToAnyX, &ToAnyX,
+  &NegateX, &ComplementX, &NotX, &TrueX,
+  &AddX, &SubtractX, &MultiplyX, &DivideX, &ModuloX, &PowerX,
+  &EqualX, &NotEqualX, &GreaterX, &GreaterEQX,
+  &ShiftLX, &ShiftRX, &OrX, &AndX, &XorX,
+  &AssignX, &EvalX, &SetupX, &GetMemberX, &MatMultX, &yz_jprint
+};
+
+#ifdef YZ_PTHREAD
+static pthread_mutex_t yz_jlock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static char *yz_async_knames[] = { "level", "format", "copy", 0 };
+static long yz_async_kglobs[4];
+
+void
+Y_z_deflate_async(int nArgs)
+{
+  Symbol *args[1], *keys[3];
+  Operand op;
+  yz_job *job;
+  int level = Z_DEFAULT_COMPRESSION, format, copy;
+  if (yz_getargs(nArgs, args, 1, yz_async_knames, yz_async_kglobs,
+                 keys, "z_deflate_async") != 1)
+    YError("z_deflate_async takes exactly 1 argument");
+  if (keys[0] && YNotNil(keys[0])) {
+    level = (int)YGetInteger(keys[0]);
+    if (level<Z_DEFAULT_COMPRESSION || level>Z_BEST_COMPRESSION)
+      YError("z_deflate_async: invalid compression level");
+  }
+  format = yz_getformat(keys[1], 0, "z_deflate_async");
+  copy = (keys[2] && YNotNil(keys[2]))? (YGetInteger(keys[2])!=0) : 0;
+  args[0]->ops->FormOperand(args[0], &op);
+  if (!op.ops->isArray)
+    YError("z_deflate_async input data must be an array data type");
+  if (op.ops==&stringOps || op.ops==&pointerOps)
+    YError("z_deflate_async cannot handle string or pointer input data");
+
+  job = p_malloc(sizeof(yz_job));
+  job->references = 0;
+  job->ops = &yz_jops;
+  job->in = job->result = 0;
+  job->out = 0;
+  job->lout = 0;
+  job->flag = Z_OK;
+  job->level = level;
+  job->format = format;
+  job->lin = op.type.number * op.type.base->size;
+#ifdef YZ_PTHREAD
+  job->busy = job->done = 0;
+#endif
+  PushDataBlock(job);
+  if (!copy && op.owner->ops==&dataBlockSym) {
+    job->in = Ref((Array *)op.owner->value.db);
+  } else {
+    /* scalars live on the stack, and copy=1 asks for a snapshot */
+    job->in = NewArray(&charStruct, ynew_dim(job->lin, (void*)0));
+    memcpy(job->in->value.c, op.value, job->lin);
+  }
+
+#ifdef YZ_PTHREAD
+  if (!pthread_create(&job->thread, 0, &yz_job_work, job)) {
+    job->busy = 1;
+    return;
+  }
+#endif
+  yz_job_work(job);
+}
+
+/* z_wait(job) waits for job, z_wait(job, 0) returns [] if not done */
+void
+Y_z_wait(int nArgs)
+{
+  Symbol *stack = sp-nArgs+1;
+  Operand op;
+  yz_job *job;
+  int block = 1;
+  if (nArgs<1 || nArgs>2) YError("z_wait takes 1 or 2 arguments");
+  if (!stack->ops) YError("z_wait takes no keywords");
+  stack->ops->FormOperand(stack, &op);
+  if (op.ops != &yz_jops)
+    YError("z_wait first parameter must be a z_deflate_async job");
+  job = op.value;
+  if (nArgs == 2) block = (YGetInteger(sp) != 0);
+  if (!yz_jwait(job, block)) {
+    PushDataBlock(RefNC(&nilDB));
+    return;
+  }
+  if (!job->result) {
+    double *g = yz_gstats[0];
+    if (job->flag != Z_OK) {
+      if (job->out) free(job->out);
+      job->out = 0;
+      if (job->flag == Z_MEM_ERROR)
+        YError("z_wait: memory error in z_deflate_async job");
+      else
+        YError("z_wait: zlib error in z_deflate_async job");
+    }
+    job->result = NewArray(&charStruct, ynew_dim(job->lout, (void*)0));
+    memcpy(job->result->value.c, job->out, job->lout);
+    free(job->out);
+    job->out = 0;
+    Unref(job->in);
+    job->in = 0;
+    /* each job counts as a buffer with one chunk */
+    g[0] += 1.0;
+    g[1] += 1.0;
+    g[2] += (double)job->lin;
+    g[3] += (double)job->lout;
+  }
+  PushDataBlock(Ref(job->result));
+}
+
+/* join the worker thread if it has finished (or block is set),
+ * returning 1 if the job is complete */
+static int
+yz_jwait(yz_job *job, int block)
+{
+#ifdef YZ_PTHREAD
+  if (job->busy) {
+    if (!block) {
+      pthread_mutex_lock(&yz_jlock);
+      block = job->done;
+      pthread_mutex_unlock(&yz_jlock);
+      if (!block) return 0;
+    }
+    pthread_join(job->thread, 0);
+    job->busy = 0;
+  }
+#endif
+  return 1;
+}
+
+static void
+yz_jfree(void *jobv)
+{
+  yz_job *job = jobv;
+  yz_jwait(job, 1);
+  if (job->out) free(job->out);
+  Unref(job->in);
+  Unref(job->result);
+  p_free(job);
+}
+
+static void
+yz_jprint(Operand *op)
+{
+  yz_job *job = op->value;
+  char line[120];
+  ForceNewline();
+  if (!yz_jwait(job, 0))
+    sprintf(line, "zlib_job deflating %lu bytes", job->lin);
+  else if (job->flag != Z_OK)
+    sprintf(line, "zlib_job failed deflating %lu bytes", job->lin);
+  else
+    sprintf(line, "zlib_job done, %lu bytes in, %lu bytes out",
+            job->lin, job->lout);
+  PrintFunc(line);
+  ForceNewline();
+}
+
+/* may run in worker thread: no yorick calls, no p_malloc */
+static void *
+yz_job_work(void *jobv)
+{
+  yz_job *job = jobv;
+  Bytef *in = (Bytef *)job->in->value.c;
+  unsigned long lin = job->lin;
+#ifdef YZ_LIBDEFLATE
+  /* a private compressor, since yz_ldc belongs to the main thread */
+  struct libdeflate_compressor *c =
+    libdeflate_alloc_compressor((job->level==Z_DEFAULT_COMPRESSION)?
+                                6 : job->level);
+  if (c) {
+    size_t bound = yz_ldbound(c, job->format, lin);
+    job->out = malloc(bound? bound : 1);
+    if (!job->out) job->flag = Z_MEM_ERROR;
+    else if (!(job->lout = yz_ldcompress(c, job->format, in, lin,
+                                         job->out, bound)))
+      job->flag = Z_BUF_ERROR;
+    libdeflate_free_compressor(c);
+  } else
+#endif
+  {
+    z_stream zs;
+    unsigned long left = lin, bound, avail;
+    zs.zalloc = &yz_zalloc;
+    zs.zfree = &yz_zfree;
+    zs.opaque = Z_NULL;
+    job->flag = deflateInit2(&zs, job->level, Z_DEFLATED,
+                             yz_wbits[job->format], 8, Z_DEFAULT_STRATEGY);
+    if (job->flag == Z_OK) {
+      bound = avail = deflateBound(&zs, lin);
+      job->out = malloc(bound);
+      if (!job->out) job->flag = Z_MEM_ERROR;
+      zs.next_in = in;
+      zs.avail_in = yz_slice(&left);
+      zs.next_out = job->out;
+      zs.avail_out = yz_slice(&avail);
+      while (job->flag == Z_OK) {
+        job->flag = deflate(&zs, left? Z_NO_FLUSH : Z_FINISH);
+        if (job->flag == Z_STREAM_END) break;
+        if (job->flag == Z_BUF_ERROR) job->flag = Z_OK;
+        if (!zs.avail_in) zs.avail_in = yz_slice(&left);
+        if (!zs.avail_out) zs.avail_out = yz_slice(&avail);
+        if (!zs.avail_in && !zs.avail_out && !avail) job->flag = Z_BUF_ERROR;
+      }
+      if (job->flag == Z_STREAM_END) job->flag = Z_OK;
+      job->lout = (Bytef *)zs.next_out - job->out;
+      deflateEnd(&zs);
+    }
+  }
+#ifdef YZ_PTHREAD
+  pthread_mutex_lock(&yz_jlock);
+  job->done = 1;
+  pthread_mutex_unlock(&yz_jlock);
+#endif
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/* Dictionary training (z_dict_train), after the cover algorithm of Liu,
+ * Vassilvitskii, and Cole used by zstd: The frequency of each d byte
+ * substring (dmer) is the number of samples in which it occurs.  The
+ * concatenated samples are divided into epochs, one for each k byte
+ * segment the dictionary will hold, and from each epoch the segment
+ * with the largest total frequency of distinct dmers is chosen for the
+ * dictionary.  The frequencies of its dmers are then zeroed, so that
+ * later segments cover different content.  Since deflate codes nearer
+ * matches in fewer bits, and zlib uses only the final 32k of a longer
+ * dictionary, segments are placed from the end of the dictionary
+ * toward its beginning in the order chosen.  Without k=, several k are
+ * tried, keeping the dictionary that best compresses every fifth
+ * sample.  dmers are hashed to YZ_THBITS bits; collisions merely
+ * perturb the frequencies slightly.  */
+
+#define YZ_THBITS 20
+#define YZ_THASH (1L<<YZ_THBITS)
+#define YZ_TNONE 0xffffffffU
+
+typedef struct yz_trainer yz_trainer;
+struct yz_trainer {
+  Bytef *data;           /* concatenated samples */
+  long ldata;
+  unsigned int *hash;    /* ldata dmer hashes, YZ_TNONE if crossing end */
+  unsigned int *freq;    /* YZ_THASH number of samples containing dmer */
+  unsigned int *active;  /* YZ_THASH occurrences in current segment */
+  long nsamples;
+  Bytef **sample;        /* nsamples sample pointers into data */
+  long *lsample;
+};
+
+static char *yz_train_knames[] = { "size", "k", "d", 0 };
+static long yz_train_kglobs[4];
+
+static void yz_tcount(yz_trainer *t, int d);
+static long yz_tbuild(yz_trainer *t, long k, int d, Bytef *dict, long ldict);
+static long yz_tscore(yz_trainer *t, Bytef *dict, long ldict);
+
+void
+Y_z_dict_train(int nArgs)
+{
+  Symbol *args[1], *keys[3];
+  Operand op;
+  Array *result;
+  yz_trainer t;
+  void **list;
+  long i, n, ldict = 32768, k = 0, best = 0;
+  long ks[4] = { 64, 128, 256, 512 };
+  int d = 6;
+  Bytef *dict, *trial;
+  if (yz_getargs(nArgs, args, 1, yz_train_knames, yz_train_kglobs,
+                 keys, "z_dict_train") != 1)
+    YError("z_dict_train takes exactly 1 argument");
+  if (keys[0] && YNotNil(keys[0])) {
+    ldict = YGetInteger(keys[0]);
+    if (ldict<256 || ldict>32768)
+      YError("z_dict_train: size= must be between 256 and 32768");
+  }
+  if (keys[1] && YNotNil(keys[1])) {
+    k = YGetInteger(keys[1]);
+    if (k<16 || k>ldict) YError("z_dict_train: k= must be 16 to size=");
+  }
+  if (keys[2] && YNotNil(keys[2])) {
+    d = (int)YGetInteger(keys[2]);
+    if (d<3 || d>16) YError("z_dict_train: d= must be between 3 and 16");
+  }
+
+  args[0]->ops->FormOperand(args[0], &op);
+  if (op.ops != &pointerOps)
+    YError("z_dict_train: argument must be an array of pointers");
+  list = op.value;
+  t.nsamples = 0;
+  t.ldata = 0;
+  for (i=0 ; i<op.type.number ; i++) {
+    Array *a = list[i]? Pointee(list[i]) : 0;
+    if (!a) continue;
+    if (a->ops==&stringOps || a->ops==&pointerOps)
+      YError("z_dict_train: samples must be numeric arrays");
+    t.nsamples++;
+    t.ldata += a->type.number * a->type.base->size;
+  }
+  if (!t.ldata) YError("z_dict_train: no sample data");
+
+  t.sample = p_malloc(t.nsamples * (sizeof(Bytef *) + sizeof(long)));
+  t.lsample = (long *)(t.sample + t.nsamples);
+  t.data = p_malloc(t.ldata + 2*ldict);
+  dict = t.data + t.ldata;
+  trial = dict + ldict;
+  for (i=n=t.ldata=0 ; i<op.type.number ; i++) {
+    Array *a = list[i]? Pointee(list[i]) : 0;
+    if (!a) continue;
+    t.sample[n] = t.data + t.ldata;
+    t.lsample[n] = a->type.number * a->type.base->size;
+    memcpy(t.sample[n], a->value.c, t.lsample[n]);
+    t.ldata += t.lsample[n++];
+  }
+
+  if (t.ldata <= ldict) {
+    /* samples fit in dictionary, nothing to choose */
+    ldict = t.ldata;
+    memcpy(dict, t.data, ldict);
+  } else {
+    t.hash = p_malloc((t.ldata + 2*YZ_THASH) * sizeof(unsigned int));
+    t.freq = t.hash + t.ldata;
+    t.active = t.freq + YZ_THASH;
+    yz_tcount(&t, d);
+    if (k) {
+      ldict = yz_tbuild(&t, k, d, dict, ldict);
+    } else {
+      long size, lbest = 0, ltrial;
+      for (i=0 ; i<4 ; i++) {
+        if (ks[i] > ldict) break;
+        if (i) yz_tcount(&t, d);  /* yz_tbuild zeroes freq */
+        ltrial = yz_tbuild(&t, ks[i], d, trial, ldict);
+        size = yz_tscore(&t, trial, ltrial);
+        if (!lbest || (size>=0 && size<best)) {
+          best = size;
+          lbest = ltrial;
+          memcpy(dict, trial, ltrial);
+        }
+      }
+      ldict = lbest;
+    }
+    p_free(t.hash);
+  }
+
+  result = (Array *)PushDataBlock(NewArray(&charStruct,
+                                           ynew_dim(ldict, (void*)0)));
+  memcpy(result->value.c, dict, ldict);
+  p_free(t.data);
+  p_free(t.sample);
+}
+
+/* hash every dmer, count number of samples containing each */
+static void
+yz_tcount(yz_trainer *t, int d)
+{
+  unsigned int *last = t->active;  /* last sample counted, borrowed */
+  long i, j, s;
+  for (i=0 ; i<YZ_THASH ; i++) t->freq[i] = 0, last[i] = YZ_TNONE;
+  for (s=i=0 ; s<t->nsamples ; s++) {
+    Bytef *x = t->sample[s];
+    for (j=0 ; j<t->lsample[s] ; j++, i++) {
+      unsigned int h = 0;
+      int m;
+      if (j+d > t->lsample[s]) {
+        t->hash[i] = YZ_TNONE;
+        continue;
+      }
+      for (m=0 ; m<d ; m++) h = h*0x9e3779b1U + x[j+m];
+      h = (h * 0x9e3779b1U) >> (32-YZ_THBITS);
+      t->hash[i] = h;
+      if (last[h] != (unsigned int)s) {
+        last[h] = (unsigned int)s;
+        t->freq[h]++;
+      }
+    }
+  }
+  for (i=0 ; i<YZ_THASH ; i++) last[i] = 0;
+}
+
+/* choose segments, fill dict from end, return dictionary length */
+static long
+yz_tbuild(yz_trainer *t, long k, int d, Bytef *dict, long ldict)
+{
+  long nepochs = ldict / k, lepoch, e, i, tail = ldict;
+  unsigned int *hash = t->hash, *freq = t->freq, *active = t->active;
+  if (nepochs < 1) nepochs = 1;
+  lepoch = t->ldata / nepochs;
+  if (lepoch < k) lepoch = k, nepochs = t->ldata / k;
+  for (e=0 ; e<nepochs && tail>0 ; e++) {
+    long start = e*lepoch, end = start + lepoch, seg = -1, len;
+    long score = 0, bscore = 0;
+    if (end > t->ldata) end = t->ldata;
+    /* slide k byte window over epoch, score = sum freq of distinct dmers */
+    for (i=start ; i<end ; i++) {
+      unsigned int h = hash[i];
+      if (h != YZ_TNONE && !active[h]++) score += freq[h];
+      if (i-start >= k) {
+        h = hash[i-k];
+        if (h != YZ_TNONE && !--active[h]) score -= freq[h];
+      }
+      if (i-start >= k-1 && score > bscore) {
+        bscore = score;
+        seg = i - k + 1;
+      }
+    }
+    for (i=(end-k>start? end-k : start) ; i<end ; i++)
+      if (hash[i] != YZ_TNONE) active[hash[i]] = 0;
+    if (seg < 0) continue;  /* nothing in epoch occurs in two samples */
+    /* the last d-1 bytes complete the final dmer */
+    len = k + d - 1;
+    if (seg + len > t->ldata) len = t->ldata - seg;
+    if (len > tail) len = tail;
+    tail -= len;
+    memcpy(dict+tail, t->data+seg, len);
+    for (i=seg ; i<seg+len ; i++)
+      if (hash[i] != YZ_TNONE) freq[hash[i]] = 0;
+  }
+  if (tail) memmove(dict, dict+tail, ldict-tail);
+  return ldict - tail;
+}
+
+/* total compressed size of every fifth sample using dict, or -1 */
+static long
+yz_tscore(yz_trainer *t, Bytef *dict, long ldict)
+{
+  z_stream zs;
+  Bytef buf[16384];
+  long s, total = 0;
+  zs.zalloc = &yz_zalloc;
+  zs.zfree = &yz_zfree;
+  zs.opaque = Z_NULL;
+  if (deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK) return -1;
+  for (s=0 ; s<t->nsamples ; s+=5) {
+    int flag;
+    deflateReset(&zs);
+    if (ldict) deflateSetDictionary(&zs, dict, (uInt)ldict);
+    zs.next_in = t->sample[s];
+    zs.avail_in = (uInt)t->lsample[s];
+    do {
+      zs.next_out = buf;
+      zs.avail_out = sizeof(buf);
+      flag = deflate(&zs, Z_FINISH);
+      total += sizeof(buf) - zs.avail_out;
+    } while (flag == Z_OK);
+  }
+  deflateEnd(&zs);
+  return total;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/* Alternative codecs (z_deflate codec=):
+ * codec="zstd" or codec="lz4" replaces zlib deflate with a zstd frame
+ * or an lz4 frame, both much faster than deflate at some cost in
+ * compression ratio.  The z_deflate, z_inflate, z_flush calling
+ * sequence is unchanged: yz_cdeflate and yz_cinflate take the place of
+ * the zlib loops, filling the same output buffer with yz_getspace or
+ * yz_reserve, and yz_cinflate returns the same flags as z_inflate.  For
+ * yz_inflate_guess, the input and output totals are kept in the unused
+ * zs.total_in and zs.total_out.  Both frame formats begin with a magic
+ * number, which z_inflate format="auto" recognizes.  For zstd, threads=
+ * sets the number of zstd worker threads (if libzstd supports them).
+ * The context is freed as soon as the stream ends.  */
+
+/* lz4 input is fed in pieces of this size, so compressBound is modest */
+#define YZ_LZ4CHUNK 1048576L
+
+static int
+yz_cinit(yz_stream *yzs, int inflate, int nthreads)
+{
+  yzs->cctx = 0;
+  if (yzs->codec == YZ_CZSTD) {
+#ifdef YZ_ZSTD
+    if (inflate) {
+      yzs->cctx = ZSTD_createDCtx();
+    } else {
+      ZSTD_CCtx *cctx = ZSTD_createCCtx();
+      int level = yzs->level;
+      if (!cctx) return Z_MEM_ERROR;
+      if (level == Z_DEFAULT_COMPRESSION) level = ZSTD_CLEVEL_DEFAULT;
+      if (level<Z_DEFAULT_COMPRESSION || level>ZSTD_maxCLevel() ||
+          ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                                              level))) {
+        ZSTD_freeCCtx(cctx);
+        return Z_STREAM_ERROR;
+      }
+      ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+      /* fails harmlessly if libzstd was built without threads */
+      if (nthreads > 1) ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, nthreads);
+      yzs->cctx = cctx;
+    }
+    return yzs->cctx? Z_OK : Z_MEM_ERROR;
+#endif
+  } else if (yzs->codec == YZ_CLZ4) {
+#ifdef YZ_LZ4
+    if (inflate) {
+      LZ4F_dctx *dctx;
+      if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+        return Z_MEM_ERROR;
+      yzs->cctx = dctx;
+    } else {
+      LZ4F_cctx *cctx;
+      int level = yzs->level;
+      if (level<Z_DEFAULT_COMPRESSION || level>LZ4F_compressionLevel_max())
+        return Z_STREAM_ERROR;
+      if (LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION)))
+        return Z_MEM_ERROR;
+      yzs->cctx = cctx;
+    }
+    return Z_OK;
+#endif
+  }
+  return Z_VERSION_ERROR;
+}
+
+static void
+yz_cfree(yz_stream *yzs, int inflate)
+{
+  if (!yzs->cctx) return;
+#ifdef YZ_ZSTD
+  if (yzs->codec == YZ_CZSTD) {
+    if (inflate) ZSTD_freeDCtx(yzs->cctx);
+    else ZSTD_freeCCtx(yzs->cctx);
+  }
+#endif
+#ifdef YZ_LZ4
+  if (yzs->codec == YZ_CLZ4) {
+    if (inflate) LZ4F_freeDecompressionContext(yzs->cctx);
+    else LZ4F_freeCompressionContext(yzs->cctx);
+  }
+#endif
+  yzs->cctx = 0;
+}
+
+static void
+yz_cdeflate(yz_stream *yzs, Bytef *data, unsigned long ldata, int flush)
+{
+  int final = (flush == Z_FINISH);
+  char *msg = 0;
+  yzs->zs.total_in += ldata;
+#ifdef YZ_ZSTD
+  if (yzs->codec == YZ_CZSTD) {
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+    size_t left;
+    in.src = data;
+    in.size = ldata;
+    in.pos = 0;
+    for (;;) {
+      out.dst = yz_getspace(yzs, (ldata>>2) + 1);
+      out.size = yzs->out->type.number - yzs->used;
+      out.pos = 0;
+      left = ZSTD_compressStream2(yzs->cctx, &out, &in,
+                                  final? ZSTD_e_end : flush? ZSTD_e_flush :
+                                  ZSTD_e_continue);
+      yzs->used += out.pos;
+      yzs->zs.total_out += out.pos;
+      if (ZSTD_isError(left)) {
+        msg = "zstd error during compression";
+        break;
+      }
+      if (flush? !left : (in.pos==in.size && out.pos<out.size)) break;
+    }
+  }
+#endif
+#ifdef YZ_LZ4
+  if (yzs->codec == YZ_CLZ4) {
+    LZ4F_preferences_t prefs;
+    size_t n;
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.compressionLevel = (yzs->level<0)? 0 : yzs->level;
+    prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+    if (!yzs->zs.total_out) {
+      n = LZ4F_compressBegin(yzs->cctx, yz_reserve(yzs, LZ4F_HEADER_SIZE_MAX),
+                             LZ4F_HEADER_SIZE_MAX, &prefs);
+      if (LZ4F_isError(n)) msg = "lz4 error beginning frame";
+      else yzs->used += n, yzs->zs.total_out += n;
+    }
+    while (!msg && (ldata || final)) {
+      unsigned long lin = (ldata>YZ_LZ4CHUNK)? YZ_LZ4CHUNK : ldata;
+      size_t bound = LZ4F_compressBound(lin, &prefs);
+      Bytef *dst = yz_reserve(yzs, bound);
+      if (lin) n = LZ4F_compressUpdate(yzs->cctx, dst, bound, data, lin, 0);
+      else n = LZ4F_compressEnd(yzs->cctx, dst, bound, 0);
+      if (LZ4F_isError(n)) {
+        msg = "lz4 error during compression";
+        break;
+      }
+      yzs->used += n;
+      yzs->zs.total_out += n;
+      data += lin;
+      ldata -= lin;
+      if (!lin) break;
+    }
+    if (!msg && flush && !final) {
+      size_t bound = LZ4F_compressBound(0, &prefs);
+      n = LZ4F_flush(yzs->cctx, yz_reserve(yzs, bound), bound, 0);
+      if (LZ4F_isError(n)) msg = "lz4 error flushing frame";
+      else yzs->used += n, yzs->zs.total_out += n;
+    }
+  }
+#endif
+  if (msg || final) {
+    yz_cfree(yzs, 0);
+    yzs->status = 0;
+  }
+  if (msg) YError(msg);
+}
+
+/* return z_inflate flag: 0 done, -1 done with extra bytes, 1 or 2 need
+ * more input (2 if output available), -2 corrupted; *ndata incremented
+ * by the number of bytes written to data */
+static long
+yz_cinflate(yz_stream *yzs, int targ, Bytef *zdata, unsigned long lzdata,
+            Bytef *data, unsigned long ldata, unsigned long *ndata)
+{
+  int done = 0, bad = 0;
+  unsigned long lguess = yz_inflate_guess(yzs, lzdata);
+  for (;;) {
+    unsigned long avail, nin = lzdata, nout;
+    if (!data) {
+      yz_getspace(yzs, lguess);
+      avail = yzs->out->type.number - yzs->used;
+    } else {
+      avail = ldata;
+    }
+    nout = avail;
+#ifdef YZ_ZSTD
+    if (yzs->codec == YZ_CZSTD) {
+      Bytef *dst = data? data : (Bytef *)yzs->out->value.c + yzs->used;
+      ZSTD_inBuffer in;
+      ZSTD_outBuffer out;
+      size_t left;
+      in.src = zdata;
+      in.size = lzdata;
+      in.pos = 0;
+      out.dst = dst;
+      out.size = avail;
+      out.pos = 0;
+      left = ZSTD_decompressStream(yzs->cctx, &out, &in);
+      if (ZSTD_isError(left)) bad = 1;
+      else done = !left;
+      nin = in.pos;
+      nout = out.pos;
+    }
+#endif
+#ifdef YZ_LZ4
+    if (yzs->codec == YZ_CLZ4) {
+      Bytef *dst = data? data : (Bytef *)yzs->out->value.c + yzs->used;
+      size_t lin = lzdata, lout = avail;
+      size_t left = LZ4F_decompress(yzs->cctx, dst, &lout, zdata, &lin, 0);
+      if (LZ4F_isError(left)) bad = 1;
+      else done = !left;
+      nin = lin;
+      nout = lout;
+    }
+#endif
+    zdata += nin;
+    lzdata -= nin;
+    yzs->zs.total_in += nin;
+    yzs->zs.total_out += nout;
+    if (!data) yzs->used += nout;
+    else data += nout, ldata -= nout, *ndata += nout;
+    if (targ && data) yzs->toff += nout;
+    if (bad || done) break;
+    if (nout < avail) {
+      if (!lzdata) break;        /* need more input */
+      if (!nin && !nout) break;  /* no progress, should not happen */
+    } else if (data && !ldata) {
+      /* caller array full, continue in next z_target array or in
+       * internal buffer */
+      data = targ? yz_tnext(yzs, &ldata) : 0;
+    }
+    lguess = yz_inflate_guess(yzs, lzdata);
+  }
+  if (bad || done) {
+    yz_cfree(yzs, 1);
+    yzs->status = bad? 0 : 3;
+    return bad? -2 : (lzdata? -1 : 0);
+  }
+  return yzs->used? 2 : 1;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/* Pre-filters for typed numeric data (z_deflate filter=):
+ * The input is cut into blocks of YZ_FBLOCK bytes (rounded down to
+ * whole elements), independent of how it was divided among z_deflate
+ * calls, and each block is optionally replaced by its first differences
+ * (delta, elements treated as unsigned integers, so exact for floating
+ * point), then byte shuffled (byte j of every element together, as in
+ * HDF5) or bit shuffled (bit plane by bit plane).  Either puts the
+ * slowly varying high order bytes of smooth data into long runs that
+ * deflate handles far better than interleaved IEEE bytes.
+ * The filtered data is preceded by a 16 byte header (yz_fmagic, then
+ * version, filter bits, element size), all inside the compressed
+ * stream, so the stream remains ordinary zlib (or gzip, zstd, ...).
+ * On inflate with filter=1, yz_fpost requires the header in the first
+ * 16 bytes of output, strips it, and undoes the filters one block at a
+ * time as the blocks become complete; only unfiltered bytes are passed
+ * to z_flush or a z_inflate data array.  Without filter=1, output is
+ * never examined, so any data may begin with the header bytes.  */
+
+#define YZ_FBLOCK 65536L
+#define YZ_FHEAD 16
+
+static Byte yz_fmagic[8] = { 0x89, 'Y', 'Z', 'F', '\r', '\n', 0x1a, '\n' };
+
+static void yz_filter(int filter, int elsize, Bytef *dst, Bytef *src,
+                      long nbytes, Bytef *tmp);
+static void yz_unfilter(int filter, int elsize, Bytef *data,
+                        long nbytes, Bytef *tmp);
+
+static void
+yz_fdeflate(yz_stream *yzs, Bytef *data, unsigned long ldata, int flush)
+{
+  long blk;
+  if (!yzs->fstate) {
+    Byte head[YZ_FHEAD];
+    int elsize = yzs->elsize? yzs->elsize : 1;
+    if ((yzs->filter & YZ_DELTA) &&
+        elsize!=1 && elsize!=2 && elsize!=4 && elsize!=8)
+      yzs->filter &= ~YZ_DELTA;  /* no integer type of that size */
+    yzs->elsize = elsize;
+    memset(head, 0, YZ_FHEAD);
+    memcpy(head, yz_fmagic, 8);
+    head[8] = 1;
+    head[9] = yzs->filter;
+    head[10] = elsize;
+    yzs->fbuf = p_malloc(YZ_FBLOCK);
+    yzs->ftmp = p_malloc(2*YZ_FBLOCK);
+    yzs->fstate = 1;
+    yz_zdeflate(yzs, head, YZ_FHEAD, Z_NO_FLUSH);
+  }
+  blk = (YZ_FBLOCK / yzs->elsize) * yzs->elsize;
+
+  for (;;) {
+    Bytef *src = 0;
+    long n = 0;
+    if (yzs->nfbuf || ldata<blk) {
+      /* accumulate partial block in fbuf */
+      n = blk - yzs->nfbuf;
+      if (n > (long)ldata) n = ldata;
+      if (n) memcpy(yzs->fbuf+yzs->nfbuf, data, n);
+      yzs->nfbuf += n;
+      data += n;
+      ldata -= n;
+      if (yzs->nfbuf == blk || (flush==Z_FINISH && !ldata)) {
+        src = yzs->fbuf;
+        n = yzs->nfbuf;
+        yzs->nfbuf = 0;
+      }
+    } else {
+      /* full blocks directly from data */
+      src = data;
+      n = blk;
+      data += n;
+      ldata -= n;
+    }
+    if (!src) break;
+    yz_filter(yzs->filter, yzs->elsize, yzs->ftmp, src, n, yzs->ftmp+YZ_FBLOCK);
+    if (!ldata && !yzs->nfbuf) {
+      yz_zdeflate(yzs, yzs->ftmp, n, flush);
+      return;
+    }
+    yz_zdeflate(yzs, yzs->ftmp, n, Z_NO_FLUSH);
+  }
+  /* z_flush sync= leaves any partial block in fbuf */
+  if (flush != Z_NO_FLUSH) yz_zdeflate(yzs, (Bytef *)yzs->ftmp, 0, flush);
+}
+
+/* After z_inflate has written ndata bytes to udata (if any) and the rest
+ * to the internal buffer, recognize and strip the filter header at the
+ * start of the stream, then undo the filters for every complete block
+ * (or everything, at the end of the stream), and set fready.  If output
+ * went through the internal buffer instead of udata (redir), or had to
+ * be moved there because the stream turned out to be filtered, copy as
+ * much as fits back to udata.  Returns the z_inflate flag.  */
+static long
+yz_fpost(yz_stream *yzs, int flag, Bytef *udata, unsigned long ludata,
+         unsigned long ndata, int redir)
+{
+  /* a gzip stream stays open (status 2) after each member, flag 0 */
+  int ended = (yzs->status != 2 || !flag);
+  if (!yzs->fstate) {
+    Bytef *head = ndata? udata : (yzs->out? (Bytef *)yzs->out->value.c : 0);
+    long nhead = ndata? ndata : yzs->used;
+    if (nhead>=YZ_FHEAD && !memcmp(head, yz_fmagic, 8) && head[8]==1 &&
+        !(head[9]&~(YZ_DELTA|YZ_SHUFFLE|YZ_BITSHUF)) && head[10]) {
+      yzs->filter = head[9];
+      yzs->elsize = head[10];
+      yzs->ftmp = p_malloc(2*YZ_FBLOCK);
+      yzs->fstate = 2;
+    } else if (nhead>=YZ_FHEAD || ended) {
+      YError("z_inflate: filter=1, but ZDATA has no z_deflate filter= header");
+    }
+    if (ndata && yzs->fstate!=1) {
+      /* move bytes written to udata to front of internal buffer */
+      redir = 1;
+      yz_reserve(yzs, ndata);
+      if (yzs->used)
+        memmove(yzs->out->value.c+ndata, yzs->out->value.c, yzs->used);
+      memcpy(yzs->out->value.c, udata, ndata);
+      yzs->used += ndata;
+    }
+    if (yzs->fstate == 2) {
+      yzs->used -= YZ_FHEAD;
+      memmove(yzs->out->value.c, yzs->out->value.c+YZ_FHEAD, yzs->used);
+      yzs->fready = 0;
+    }
+  }
+
+  if (yzs->fstate == 1) {
+    yzs->fready = yzs->used;
+  } else if (yzs->fstate==2 && yzs->out) {
+    long blk = (YZ_FBLOCK / yzs->elsize) * yzs->elsize, n;
+    Bytef *out = (Bytef *)yzs->out->value.c;
+    for (;;) {
+      n = yzs->used - yzs->fready;
+      if (n > blk) n = blk;
+      if (!n || (n<blk && !ended)) break;
+      yz_unfilter(yzs->filter, yzs->elsize, out+yzs->fready, n, yzs->ftmp);
+      yzs->fready += n;
+    }
+  }
+  if (!redir) yzs->ndirect += ndata;
+  if (redir && yzs->fready) {
+    Bytef *out = (Bytef *)yzs->out->value.c;
+    long n = (yzs->fready < (long)ludata)? yzs->fready : (long)ludata;
+    yzs->ndirect += n;
+    memcpy(udata, out, n);
+    yzs->used -= n;
+    yzs->fready -= n;
+    memmove(out, out+n, yzs->used);
+  }
+  if (flag==1 || flag==2) flag = yzs->fready? 2 : 1;
+  return flag;
+}
+
+/* delta, then shuffle or bitshuffle, nbytes of src to dst; tmp is a
+ * scratch array of YZ_FBLOCK bytes */
+static void
+yz_filter(int filter, int elsize, Bytef *dst, Bytef *src,
+          long nbytes, Bytef *tmp)
+{
+  long i, j, n = nbytes / elsize, m = n*elsize;
+  if (filter & YZ_DELTA) {
+    memcpy(tmp, src, nbytes);
+    src = tmp;
+    if (elsize == 1) {
+      Byte *x = tmp;
+      for (i=n-1 ; i>0 ; i--) x[i] -= x[i-1];
+    } else if (elsize == 2) {
+      unsigned short *x = (unsigned short *)tmp;
+      for (i=n-1 ; i>0 ; i--) x[i] -= x[i-1];
+    } else if (elsize == 4) {
+      unsigned int *x = (unsigned int *)tmp;
+      for (i=n-1 ; i>0 ; i--) x[i] -= x[i-1];
+    } else {
+      unsigned long long *x = (unsigned long long *)tmp;
+      for (i=n-1 ; i>0 ; i--) x[i] -= x[i-1];
+    }
+  }
+  if (filter & YZ_SHUFFLE) {
+    for (j=0 ; j<elsize ; j++)
+      for (i=0 ; i<n ; i++) dst[j*n+i] = src[i*elsize+j];
+  } else if (filter & YZ_BITSHUF) {
+    /* 8 elements at a time: 8x8 bit matrix transpose for each byte */
+    long n8 = n >> 3;
+    for (j=0 ; j<elsize ; j++) {
+      for (i=0 ; i<n8 ; i++) {
+        Bytef *x = src + 8*i*elsize + j;
+        unsigned long long t, y = 0;
+        int k;
+        for (k=0 ; k<8 ; k++) y |= (unsigned long long)x[k*elsize] << (8*k);
+        t = (y ^ (y >> 7)) & 0x00aa00aa00aa00aaULL;
+        y ^= t ^ (t << 7);
+        t = (y ^ (y >> 14)) & 0x0000cccc0000ccccULL;
+        y ^= t ^ (t << 14);
+        t = (y ^ (y >> 28)) & 0x00000000f0f0f0f0ULL;
+        y ^= t ^ (t << 28);
+        for (k=0 ; k<8 ; k++) dst[(8*j+k)*n8 + i] = (Byte)(y >> (8*k));
+      }
+    }
+    /* elements beyond a multiple of 8 are left as they are */
+    m = 8*n8*elsize;
+  } else {
+    m = 0;
+  }
+  if (m < nbytes) memcpy(dst+m, src+m, nbytes-m);
+}
+
+/* undo yz_filter in place on nbytes of data */
+static void
+yz_unfilter(int filter, int elsize, Bytef *data, long nbytes, Bytef *tmp)
+{
+  long i, j, n = nbytes / elsize, m = nbytes;
+  if (filter & YZ_SHUFFLE) {
+    for (j=0 ; j<elsize ; j++)
+      for (i=0 ; i<n ; i++) tmp[i*elsize+j] = data[j*n+i];
+    m = n*elsize;
+  } else if (filter & YZ_BITSHUF) {
+    /* the 8x8 bit transpose is its own inverse */
+    long n8 = n >> 3;
+    for (j=0 ; j<elsize ; j++) {
+      for (i=0 ; i<n8 ; i++) {
+        unsigned long long t, y = 0;
+        int k;
+        for (k=0 ; k<8 ; k++)
+          y |= (unsigned long long)data[(8*j+k)*n8 + i] << (8*k);
+        t = (y ^ (y >> 7)) & 0x00aa00aa00aa00aaULL;
+        y ^= t ^ (t << 7);
+        t = (y ^ (y >> 14)) & 0x0000cccc0000ccccULL;
+        y ^= t ^ (t << 14);
+        t = (y ^ (y >> 28)) & 0x00000000f0f0f0f0ULL;
+        y ^= t ^ (t << 28);
+        for (k=0 ; k<8 ; k++) tmp[(8*i+k)*elsize + j] = (Byte)(y >> (8*k));
+      }
+    }
+    m = 8*n8*elsize;
+  } else {
+    m = 0;
+  }
+  if (m < nbytes) memcpy(tmp+m, data+m, nbytes-m);
+  if (filter & YZ_DELTA) {
+    if (elsize == 1) {
+      Byte *x = tmp;
+      for (i=1 ; i<n ; i++) x[i] += x[i-1];
+    } else if (elsize == 2) {
+      unsigned short *x = (unsigned short *)tmp;
+      for (i=1 ; i<n ; i++) x[i] += x[i-1];
+    } else if (elsize == 4) {
+      unsigned int *x = (unsigned int *)tmp;
+      for (i=1 ; i<n ; i++) x[i] += x[i-1];
+    } else {
+      unsigned long long *x = (unsigned long long *)tmp;
+      for (i=1 ; i<n ; i++) x[i] += x[i-1];
+    }
+  }
+  memcpy(data, tmp, nbytes);
+}
+
+/*--------------------------------------------------------------------------*/
+
+/* Pooled zlib memory (z_pool):
+ * Every z_stream here allocates its internal state through yz_zalloc
+ * and yz_zfree.  When a stream ends, its blocks (for deflate the window,
+ * hash chains, and pending buffer, over 256k in all) go onto a free list
+ * for their exact size instead of back to the system, and the next
+ * stream with the same parameters takes them from there.  Since zlib
+ * makes only a handful of distinct request sizes, YZ_NCLASS lists are
+ * plenty; a block of any other size is simply freed.  The total held
+ * in the lists is capped at yz_alimit bytes, which z_pool can change.
+ * The lists are shared with worker threads, so they are locked.  */
+
+#define YZ_NCLASS 16
+#define YZ_ALIMIT 8388608L
+
+typedef union yz_ablock yz_ablock;
+union yz_ablock {
+  struct {
+    yz_ablock *next;   /* next free block of this size */
+    unsigned long size;
+  } h;
+  double align[2];     /* header size preserves malloc alignment */
+};
+
+static struct {
+  unsigned long size;
+  yz_ablock *free;
+} yz_aclass[YZ_NCLASS];
+static unsigned long yz_aheld = 0, yz_alimit = YZ_ALIMIT;
+
+#ifdef YZ_PTHREAD
+static pthread_mutex_t yz_alock = PTHREAD_MUTEX_INITIALIZER;
+#  define YZ_ALOCK() pthread_mutex_lock(&yz_alock)
+#  define YZ_AUNLOCK() pthread_mutex_unlock(&yz_alock)
+#else
+#  define YZ_ALOCK()
+#  define YZ_AUNLOCK()
+#endif
+
+/* may run in worker thread: no yorick calls, no p_malloc */
+static voidpf
+yz_zalloc(voidpf opaque, uInt items, uInt size)
+{
+  unsigned long nbytes = (unsigned long)items * size;
+  yz_ablock *b = 0;
+  int i;
+  YZ_ALOCK();
+  for (i=0 ; i<YZ_NCLASS ; i++) {
+    if (yz_aclass[i].size!=nbytes || !yz_aclass[i].free) continue;
+    b = yz_aclass[i].free;
+    yz_aclass[i].free = b->h.next;
+    yz_aheld -= nbytes;
+    break;
+  }
+  YZ_AUNLOCK();
+  if (!b) {
+    b = malloc(sizeof(yz_ablock) + nbytes);
+    if (!b) return Z_NULL;
+    b->h.size = nbytes;
+  }
+  return b + 1;
+}
+
+static void
+yz_zfree(voidpf opaque, voidpf address)
+{
+  yz_ablock *b = (yz_ablock *)address - 1;
+  unsigned long nbytes = b->h.size;
+  int i, j = -1;
+  YZ_ALOCK();
+  if (yz_aheld+nbytes <= yz_alimit) {
+    for (i=0 ; i<YZ_NCLASS ; i++) {
+      if (yz_aclass[i].size == nbytes) break;
+      if (j<0 && !yz_aclass[i].free) j = i;
+    }
+    if (i<YZ_NCLASS || j>=0) {
+      if (i >= YZ_NCLASS) yz_aclass[i=j].size = nbytes;
+      b->h.next = yz_aclass[i].free;
+      yz_aclass[i].free = b;
+      yz_aheld += nbytes;
+      b = 0;
+    }
+  }
+  YZ_AUNLOCK();
+  if (b) free(b);
+}
+
+/* release pooled blocks until no more than limit bytes are held */
+static void
+yz_atrim(unsigned long limit)
+{
+  yz_ablock *b;
+  int i;
+  YZ_ALOCK();
+  for (i=0 ; i<YZ_NCLASS && yz_aheld>limit ; i++) {
+    while (yz_aclass[i].free && yz_aheld>limit) {
+      b = yz_aclass[i].free;
+      yz_aclass[i].free = b->h.next;
+      yz_aheld -= b->h.size;
+      free(b);
+    }
+  }
+  YZ_AUNLOCK();
+}
+
+void
+Y_z_pool(int nArgs)
+{
+  Array *result;
+  if (nArgs > 1) YError("z_pool takes at most 1 argument");
+  if (nArgs==1 && YNotNil(sp)) {
+    long limit = YGetInteger(sp);
+    if (limit < 0) YError("z_pool: limit must be non-negative");
+    yz_alimit = limit;
+    yz_bpool_free();
+    yz_atrim(yz_alimit);
+  }
+  result = (Array *)PushDataBlock(NewArray(&longStruct, ynew_dim(2L, (void*)0)));
+  result->value.l[0] = yz_aheld;
+  result->value.l[1] = yz_alimit;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/* gzip file objects (gz_open), a second foreign yorick data type which
+ * wraps a zlib gzFile, so that typed arrays can be read from or written
+ * to .gz files directly, with no pipe to an external gzip process.  */
+
+typedef struct yz_gzfile yz_gzfile;
+struct yz_gzfile {
+  int references;      /* reference counter */
+  Operations *ops;     /* virtual function table */
+  gzFile gz;           /* zlib file handle, 0 after gz_close */
+  int writing;         /* 0 read, 1 write or append */
+  char *name;          /* file name, p_malloc */
+};
+
+extern BuiltIn Y_gz_open, Y_gz_read, Y_gz_write, Y_gz_seek, Y_gz_close;
+
+extern void yz_gzfree(void *gzf);  /* ******* Use Unref(gzf) ******* */
+extern Operations yz_gzops;
+static UnaryOp yz_gzprint;
+
+Operations yz_gzops = {
+  &yz_gzfree, T_OPAQUE, 0, T_STRING, "gz_file",
+  {&PromXX, &PromXX, &PromXX, &PromXX, &PromXX, &PromXX, &PromXX, &PromXX},
+  &ToAnyX, &ToAnyX, &ToAnyX, &ToAnyX, &ToAnyX, &ToAnyX, &ToAnyX,
+  &NegateX, &ComplementX, &NotX, &TrueX,
+  &AddX, &SubtractX, &MultiplyX, &DivideX, &ModuloX, &PowerX,
+  &EqualX, &NotEqualX, &GreaterX, &GreaterEQX,
+  &ShiftLX, &ShiftRX, &OrX, &AndX, &XorX,
+  &AssignX, &EvalX, &SetupX, &GetMemberX, &MatMultX, &yz_gzprint
+};
+
+static MemryBlock yz_gzblock = {0, 0, sizeof(yz_gzfile),
+                                32*sizeof(yz_gzfile)};
+
+/* default gzbuffer size, zlib default is only 8k */
+#define YZ_GZBUF 262144L
+/* gzread and gzwrite take an unsigned length and return an int */
+#define YZ_GZCHUNK 1073741824L
+
+static yz_gzfile *yz_gzget(Symbol *stack, char *fname);
+static void *yz_gzdata(Symbol *stack, unsigned long *ldata, char *fname);
+
+void
+yz_gzfree(void *gzfv)  /* ******* Use Unref(gzf) ******* */
+{
+  yz_gzfile *gzf = gzfv;
+  if (!gzf) return;
+  if (gzf->gz) gzclose(gzf->gz);
+  gzf->gz = 0;
+  p_free(gzf->name);
+  FreeUnit(&yz_gzblock, gzf);
+}
+
+static void
+yz_gzprint(Operand *op)
+{
+  yz_gzfile *gzf = op->value;
+  ForceNewline();
+  if (!gzf->gz) PrintFunc("closed gz_file: ");
+  else if (gzf->writing) PrintFunc("gz_file open for writing: ");
+  else PrintFunc("gz_file open for reading: ");
+  PrintFunc(gzf->name);
+  ForceNewline();
+}
+
+static char *yz_gzopen_knames[] = { "buffer", 0 };
+static long yz_gzopen_kglobs[2];
+
+void
+Y_gz_open(int nArgs)
+{
+  Symbol *args[2], *keys[1];
+  char *name, *mode, *native, gzmode[16];
+  long bufsize = YZ_GZBUF;
+  yz_gzfile *gzf;
+  gzFile gz;
+  int n = yz_getargs(nArgs, args, 2, yz_gzopen_knames, yz_gzopen_kglobs,
+                     keys, "gz_open");
+  if (n < 1) YError("gz_open takes 1 or 2 arguments");
+  name = YGetString(args[0]);
+  mode = (n>1 && YNotNil(args[1]))? YGetString(args[1]) : "r";
+  if (!name || !name[0]) YError("gz_open: no file name specified");
+  if (!mode || (mode[0]!='r' && mode[0]!='w' && mode[0]!='a') ||
+      strlen(mode) > 8 || strchr(mode, '+'))
+    YError("gz_open: mode must be \"r\", \"w\", or \"a\", e.g.- \"w9\"");
+  if (keys[0] && YNotNil(keys[0])) {
+    bufsize = YGetInteger(keys[0]);
+    if (bufsize<1024 || bufsize>YZ_GZCHUNK)
+      YError("gz_open: buffer= must be between 1k and 1G bytes");
+  }
+  /* gzopen needs b on some platforms, harmless elsewhere */
+  strcpy(gzmode, mode);
+  if (!strchr(gzmode, 'b')) strcat(gzmode, "b");
+
+  native = p_native(name);
+  gz = gzopen(native, gzmode);
+  p_free(native);
+  if (!gz) YError("gz_open: unable to open file");
+  if (gzbuffer(gz, (unsigned)bufsize)) {
+    gzclose(gz);
+    YError("gz_open: gzbuffer failed");
+  }
+
+  gzf = NextUnit(&yz_gzblock);
+  gzf->references = 0;
+  gzf->ops = &yz_gzops;
+  gzf->gz = gz;
+  gzf->writing = (mode[0] != 'r');
+  gzf->name = p_strcpy(name);
+  PushDataBlock(gzf);
+}
+
+void
+Y_gz_read(int nArgs)
+{
+  yz_gzfile *gzf;
+  unsigned long ldata, ltotal = 0, size;
+  Bytef *data;
+  Operand op;
+  if (nArgs != 2) YError("gz_read takes exactly 2 arguments");
+  gzf = yz_gzget(sp-1, "gz_read");
+  if (gzf->writing) YError("gz_read: gz_file not open for reading");
+  data = yz_gzdata(sp, &ldata, "gz_read");
+  while (ldata) {
+    unsigned n = (ldata > YZ_GZCHUNK)? YZ_GZCHUNK : ldata;
+    int nread = gzread(gzf->gz, data, n);
+    if (nread < 0) YError("gz_read: zlib error reading file");
+    ltotal += nread;
+    if ((unsigned)nread < n) break;
+    data += nread;
+    ldata -= nread;
+  }
+  /* return number of complete items read, like _read */
+  sp->ops->FormOperand(sp, &op);
+  size = op.type.base->size;
+  PushLongValue((long)(ltotal / size));
+}
+
+void
+Y_gz_write(int nArgs)
+{
+  yz_gzfile *gzf;
+  unsigned long ldata;
+  Bytef *data;
+  if (nArgs != 2) YError("gz_write takes exactly 2 arguments");
+  gzf = yz_gzget(sp-1, "gz_write");
+  if (!gzf->writing) YError("gz_write: gz_file not open for writing");
+  data = yz_gzdata(sp, &ldata, "gz_write");
+  while (ldata) {
+    unsigned n = (ldata > YZ_GZCHUNK)? YZ_GZCHUNK : ldata;
+    if (gzwrite(gzf->gz, data, n) != (int)n)
+      YError("gz_write: zlib error writing file");
+    data += n;
+    ldata -= n;
+  }
+}
+
+void
+Y_gz_seek(int nArgs)
+{
+  yz_gzfile *gzf;
+  z_off_t pos;
+  if (nArgs<1 || nArgs>3) YError("gz_seek takes 1, 2, or 3 arguments");
+  gzf = yz_gzget(sp-nArgs+1, "gz_seek");
+  if (nArgs == 1) {
+    pos = gztell(gzf->gz);
+  } else {
+    long offset = YGetInteger(sp-nArgs+2);
+    int whence = (nArgs==3 && YGetInteger(sp))? SEEK_CUR : SEEK_SET;
+    pos = gzseek(gzf->gz, (z_off_t)offset, whence);
+    if (pos < 0)
+      YError(gzf->writing? "gz_seek: cannot seek backwards when writing" :
+             "gz_seek: seek failed, past end of file?");
+  }
+  PushLongValue((long)pos);
+}
+
+void
+Y_gz_close(int nArgs)
+{
+  yz_gzfile *gzf;
+  int flag;
+  if (nArgs != 1) YError("gz_close takes exactly 1 argument");
+  gzf = yz_gzget(sp, "gz_close");
+  flag = gzclose(gzf->gz);
+  gzf->gz = 0;
+  if (flag != Z_OK) YError("gz_close: zlib error flushing or closing file");
+}
+
+static yz_gzfile *
+yz_gzget(Symbol *stack, char *fname)
+{
+  char msg[80];
+  Operand op;
+  if (!stack->ops) YError("gz_file functions take no keywords");
+  stack->ops->FormOperand(stack, &op);
+  if (op.ops != &yz_gzops) {
+    sprintf(msg, "%.20s: first argument must be a gz_file", fname);
+    YError(msg);
+  }
+  if (!((yz_gzfile *)op.value)->gz) {
+    sprintf(msg, "%.20s: gz_file has been closed", fname);
+    YError(msg);
+  }
+  return op.value;
+}
+
+static void *
+yz_gzdata(Symbol *stack, unsigned long *ldata, char *fname)
+{
+  char msg[80];
+  Operand op;
+  if (!stack->ops) YError("gz_file functions take no keywords");
+  stack->ops->FormOperand(stack, &op);
+  if (!op.ops->isArray || op.ops==&stringOps || op.ops==&pointerOps) {
+    sprintf(msg, "%.20s: data must be a numeric array", fname);
+    YError(msg);
+  }
+  *ldata = op.type.number * op.type.base->size;
+  return op.value;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/* Random access index for zlib or gzip files (z_index), after Mark
+ * Adler's zran.c example in the zlib distribution:
+ * One pass inflates the whole file a deflate block at a time (Z_BLOCK),
+ * recording an access point at a block boundary every span bytes of
+ * output.  An access point is the compressed and uncompressed offsets,
+ * the number of bits of the preceding byte belonging to the block, and
+ * the 32k of uncompressed data preceding the block, which is all a raw
+ * inflate needs to begin decompressing there.  The windows are kept
+ * uncompressed in memory, but compressed in a saved index file.  */
+
+typedef struct yz_point yz_point;
+struct yz_point {
+  long in, out;          /* compressed and uncompressed offsets */
+  int bits;              /* bits from byte in-1 (0-7) */
+  Bytef window[YZ_WINDOW];
+};
+
+typedef struct yz_index yz_index;
+struct yz_index {
+  int references;      /* reference counter */
+  Operations *ops;     /* virtual function table */
+  long npoints;
+  yz_point *points;    /* p_malloc */
+  long length;         /* total uncompressed length */
+  long zlength;        /* compressed length including header and trailer */
+};
+
+extern BuiltIn Y_z_index, Y_z_index_save, Y_z_index_load, Y_z_index_read;
+
+extern void yz_ixfree(void *idx);  /* ******* Use Unref(idx) ******* */
+extern Operations yz_ixops;
+static UnaryOp yz_ixprint;
+
+Operations yz_ixops = {
+  &yz_ixfree, T_OPAQUE, 0, T_STRING, "zlib_index",
+  {&PromXX, &PromXX, &PromXX, &PromXX, &PromXX, &PromXX, &PromXX, &PromXX},
+  &ToAnyX, &ToAnyX, &ToAnyX, &ToAnyX, &ToAnyX, &ToAnyX, &ToAnyX,
+  &NegateX, &ComplementX, &NotX, &TrueX,
+  &AddX, &SubtractX, &MultiplyX, &DivideX, &ModuloX, &PowerX,
+  &EqualX, &NotEqualX, &GreaterX, &GreaterEQX,
+  &ShiftLX, &ShiftRX, &OrX, &AndX, &XorX,
+  &AssignX, &EvalX, &SetupX, &GetMemberX, &MatMultX, &yz_ixprint
+};
+
+static MemryBlock yz_ixblock = {0, 0, sizeof(yz_index), 32*sizeof(yz_index)};
+
+/* default span between access points */
+#define YZ_SPAN 16777216L
+#define YZ_ICHUNK 65536
+
+static yz_index *yz_ixcreate(void);
+static yz_point *yz_ixpoint(yz_index *idx, int bits, long in, long out,
+                            uInt left, Bytef *window);
+static yz_index *yz_ixget(Symbol *stack, char *fname);
+static char *yz_ixbuild(yz_index *idx, FILE *f, long span);
+static char *yz_ixextract(yz_index *idx, FILE *f, long offset,
+                          Bytef *data, unsigned long *ldata);
+static void yz_put8(Bytef *buf, long x);
+static long yz_get8(Bytef *buf);
+
+void
+yz_ixfree(void *idxv)  /* ******* Use Unref(idx) ******* */
+{
+  yz_index *idx = idxv;
+  if (!idx) return;
+  p_free(idx->points);
+  FreeUnit(&yz_ixblock, idx);
+}
+
+static void
+yz_ixprint(Operand *op)
+{
+  yz_index *idx = op->value;
+  char msg[96];
+  ForceNewline();
+  sprintf(msg, "zlib_index: %ld access points for %ld bytes (%ld compressed)",
+          idx->npoints, idx->length, idx->zlength);
+  PrintFunc(msg);
+  ForceNewline();
+}
+
+static yz_index *
+yz_ixcreate(void)
+{
+  yz_index *idx = NextUnit(&yz_ixblock);
+  idx->references = 0;
+  idx->ops = &yz_ixops;
+  idx->npoints = idx->length = idx->zlength = 0;
+  idx->points = 0;
+  return idx;
+}
+
+static char *yz_index_knames[] = { "span", 0 };
+static long yz_index_kglobs[2];
+
+void
+Y_z_index(int nArgs)
+{
+  Symbol *args[1], *keys[1];
+  long span = YZ_SPAN;
+  char *name, *msg;
+  FILE *f;
+  yz_index *idx;
+  if (yz_getargs(nArgs, args, 1, yz_index_knames, yz_index_kglobs,
+                 keys, "z_index") != 1)
+    YError("z_index takes exactly 1 argument");
+  if (keys[0] && YNotNil(keys[0])) {
+    span = YGetInteger(keys[0]);
+    if (span < YZ_WINDOW) YError("z_index: span= must be at least 32k");
+  }
+  name = p_native(YGetString(args[0]));
+  f = (name && name[0])? fopen(name, "rb") : 0;
+  p_free(name);
+  if (!f) YError("z_index: unable to open file");
+  idx = (yz_index *)PushDataBlock(yz_ixcreate());
+  msg = yz_ixbuild(idx, f, span);
+  fclose(f);
+  if (msg) YError(msg);
+}
+
+void
+Y_z_index_save(int nArgs)
+{
+  yz_index *idx;
+  char *name;
+  FILE *f;
+  Bytef head[32], *zwin;
+  uLongf lzwin;
+  long i;
+  int ok;
+  if (nArgs != 2) YError("z_index_save takes exactly 2 arguments");
+  idx = yz_ixget(sp-1, "z_index_save");
+  name = p_native(YGetString(sp));
+  f = (name && name[0])? fopen(name, "wb") : 0;
+  p_free(name);
+  if (!f) YError("z_index_save: unable to create file");
+  zwin = p_malloc(compressBound(YZ_WINDOW));
+  memcpy(head, "YZINDEX1", 8);  /* magic number, format version 1 */
+  yz_put8(head+8, idx->npoints);
+  yz_put8(head+16, idx->length);
+  yz_put8(head+24, idx->zlength);
+  ok = (fwrite(head, 1, 32, f) == 32);
+  for (i=0 ; ok && i<idx->npoints ; i++) {
+    yz_point *pt = idx->points + i;
+    lzwin = compressBound(YZ_WINDOW);
+    ok = (compress2(zwin, &lzwin, pt->window, YZ_WINDOW, 6) == Z_OK);
+    if (!ok) break;
+    yz_put8(head, pt->in);
+    yz_put8(head+8, pt->out);
+    yz_put8(head+16, (long)pt->bits);
+    yz_put8(head+24, (long)lzwin);
+    ok = (fwrite(head, 1, 32, f)==32 && fwrite(zwin, 1, lzwin, f)==lzwin);
+  }
+  p_free(zwin);
+  if (fclose(f)) ok = 0;
+  if (!ok) YError("z_index_save: error writing file");
+}
+
+void
+Y_z_index_load(int nArgs)
+{
+  yz_index *idx;
+  char *name, *msg = 0;
+  FILE *f;
+  Bytef head[32], *zwin;
+  uLongf lwin;
+  long i, npoints, lzwin;
+  if (nArgs != 1) YError("z_index_load takes exactly 1 argument");
+  name = p_native(YGetString(sp));
+  f = (name && name[0])? fopen(name, "rb") : 0;
+  p_free(name);
+  if (!f) YError("z_index_load: unable to open file");
+  idx = (yz_index *)PushDataBlock(yz_ixcreate());
+  if (fread(head, 1, 32, f)!=32 || memcmp(head, "YZINDEX1", 8)) {
+    fclose(f);
+    YError("z_index_load: not a z_index_save file");
+  }
+  npoints = yz_get8(head+8);
+  idx->length = yz_get8(head+16);
+  idx->zlength = yz_get8(head+24);
+  zwin = p_malloc(compressBound(YZ_WINDOW));
+  for (i=0 ; i<npoints ; i++) {
+    yz_point *pt;
+    if (fread(head, 1, 32, f) != 32) break;
+    lzwin = yz_get8(head+24);
+    if (lzwin<0 || lzwin>(long)compressBound(YZ_WINDOW)) break;
+    if (fread(zwin, 1, lzwin, f) != (size_t)lzwin) break;
+    pt = yz_ixpoint(idx, (int)yz_get8(head+16), yz_get8(head),
+                    yz_get8(head+8), YZ_WINDOW, 0);
+    lwin = YZ_WINDOW;
+    if (uncompress(pt->window, &lwin, zwin, lzwin)!=Z_OK || lwin!=YZ_WINDOW ||
+        pt->bits<0 || pt->bits>7 || pt->in<0 || pt->out<0) break;
+  }
+  p_free(zwin);
+  fclose(f);
+  if (i < npoints) msg = "z_index_load: z_index_save file corrupted";
+  else if (npoints < 1) msg = "z_index_load: index has no access points";
+  if (msg) YError(msg);
+}
+
+void
+Y_z_index_read(int nArgs)
+{
+  yz_index *idx;
+  char *name, *msg;
+  FILE *f;
+  long offset;
+  unsigned long ldata;
+  Bytef *data;
+  Operand op;
+  if (nArgs != 4) YError("z_index_read takes exactly 4 arguments");
+  idx = yz_ixget(sp-3, "z_index_read");
+  offset = YGetInteger(sp-1);
+  if (offset<0 || offset>idx->length)
+    YError("z_index_read: offset outside uncompressed data");
+  sp->ops->FormOperand(sp, &op);
+  if (!op.ops->isArray || op.ops==&stringOps || op.ops==&pointerOps)
+    YError("z_index_read: data must be a numeric array");
+  data = op.value;
+  ldata = op.type.number * op.type.base->size;
+  name = p_native(YGetString(sp-2));
+  f = (name && name[0])? fopen(name, "rb") : 0;
+  p_free(name);
+  if (!f) YError("z_index_read: unable to open file");
+  if (fseek(f, 0L, SEEK_END) || ftell(f)<idx->zlength) {
+    fclose(f);
+    YError("z_index_read: file shorter than indexed, wrong index?");
+  }
+  msg = yz_ixextract(idx, f, offset, data, &ldata);
+  fclose(f);
+  if (msg) YError(msg);
+  PushLongValue((long)(ldata / op.type.base->size));
+}
+
+static yz_index *
+yz_ixget(Symbol *stack, char *fname)
+{
+  char msg[80];
+  Operand op;
+  if (!stack->ops) YError("z_index functions take no keywords");
+  stack->ops->FormOperand(stack, &op);
+  if (op.ops != &yz_ixops) {
+    sprintf(msg, "%.20s: first argument must be a zlib_index", fname);
+    YError(msg);
+  }
+  return op.value;
+}
+
+/* add an access point, window is circular with left bytes at the end */
+static yz_point *
+yz_ixpoint(yz_index *idx, int bits, long in, long out,
+           uInt left, Bytef *window)
+{
+  yz_point *pt;
+  if (!(idx->npoints & 7))
+    idx->points = p_realloc(idx->points, (idx->npoints+8)*sizeof(yz_point));
+  pt = idx->points + idx->npoints++;
+  pt->bits = bits;
+  pt->in = in;
+  pt->out = out;
+  if (window) {
+    if (left) memcpy(pt->window, window+YZ_WINDOW-left, left);
+    if (left < YZ_WINDOW) memcpy(pt->window+left, window, YZ_WINDOW-left);
+  }
+  return pt;
+}
+
+/* inflate f once, recording access points; return error message or 0 */
+static char *
+yz_ixbuild(yz_index *idx, FILE *f, long span)
+{
+  z_stream zs;
+  Bytef *input, *window;
+  long totin = 0, totout = 0, last = 0;
+  int flag = Z_OK;
+  char *msg = 0;
+  zs.zalloc = &yz_zalloc;
+  zs.zfree = &yz_zfree;
+  zs.opaque = Z_NULL;
+  zs.avail_in = 0;
+  zs.next_in = Z_NULL;
+  /* 32+15 accepts either zlib or gzip header */
+  if (inflateInit2(&zs, 32+MAX_WBITS) != Z_OK)
+    return "z_index: zlib inflateInit2 failed";
+  input = p_malloc(YZ_ICHUNK);
+  window = p_malloc(YZ_WINDOW);
+  memset(window, 0, YZ_WINDOW);
+  zs.avail_out = 0;
+  do {
+    zs.avail_in = fread(input, 1, YZ_ICHUNK, f);
+    if (ferror(f)) { msg = "z_index: error reading file"; break; }
+    if (!zs.avail_in) { msg = "z_index: file ends before zlib stream"; break; }
+    zs.next_in = input;
+    do {
+      if (!zs.avail_out) {
+        zs.avail_out = YZ_WINDOW;
+        zs.next_out = window;
+      }
+      totin += zs.avail_in;
+      totout += zs.avail_out;
+      flag = inflate(&zs, Z_BLOCK);
+      totin -= zs.avail_in;
+      totout -= zs.avail_out;
+      if (flag == Z_STREAM_END) break;
+      if (flag != Z_OK) {
+        msg = (flag==Z_MEM_ERROR)? "z_index: out of memory in inflate" :
+          "z_index: file is not a valid zlib or gzip stream";
+        break;
+      }
+      /* at end of block which is not the last block? */
+      if ((zs.data_type & 128) && !(zs.data_type & 64) &&
+          (!totout || totout-last >= span)) {
+        yz_ixpoint(idx, zs.data_type & 7, totin, totout, zs.avail_out, window);
+        last = totout;
+      }
+    } while (zs.avail_in);
+  } while (flag==Z_OK && !msg);
+  inflateEnd(&zs);
+  p_free(window);
+  p_free(input);
+  idx->length = totout;
+  idx->zlength = totin;
+  return msg;
+}
+
+/* read *ldata bytes starting at offset into data, *ldata set to number
+ * actually read (less at end of stream); return error message or 0 */
+static char *
+yz_ixextract(yz_index *idx, FILE *f, long offset,
+             Bytef *data, unsigned long *ldata)
+{
+  z_stream zs;
+  yz_point *pt;
+  Bytef *input, *discard;
+  unsigned long want = *ldata;
+  long lo = 0, hi = idx->npoints-1, mid;
+  int flag = Z_OK, c = 0;
+  char *msg = 0;
+  if (idx->npoints < 1) return "z_index_read: index has no access points";
+  /* last access point at or before offset */
+  while (lo < hi) {
+    mid = (lo+hi+1) >> 1;
+    if (idx->points[mid].out > offset) hi = mid-1;
+    else lo = mid;
+  }
+  pt = idx->points + lo;
+  *ldata = 0;
+  if (fseek(f, pt->in - (pt->bits? 1 : 0), SEEK_SET))
+    return "z_index_read: seek failed";
+  if (pt->bits && (c = getc(f)) == EOF)
+    return "z_index_read: error reading file";
+  zs.zalloc = &yz_zalloc;
+  zs.zfree = &yz_zfree;
+  zs.opaque = Z_NULL;
+  zs.avail_in = 0;
+  zs.next_in = Z_NULL;
+  if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+    return "z_index_read: zlib inflateInit2 failed";
+  if (pt->bits) inflatePrime(&zs, pt->bits, c >> (8-pt->bits));
+  inflateSetDictionary(&zs, pt->window, YZ_WINDOW);
+
+  input = p_malloc(YZ_ICHUNK);
+  discard = p_malloc(YZ_WINDOW);
+  offset -= pt->out;
+  zs.avail_in = 0;
+  while (want) {
+    /* skip offset bytes into discard, then fill data */
+    if (offset) {
+      zs.next_out = discard;
+      zs.avail_out = (offset>YZ_WINDOW)? YZ_WINDOW : offset;
+    } else {
+      zs.next_out = data + *ldata;
+      zs.avail_out = (want>YZ_GZCHUNK)? YZ_GZCHUNK : want;
+    }
+    while (zs.avail_out) {
+      uInt before = zs.avail_out;
+      if (!zs.avail_in) {
+        zs.avail_in = fread(input, 1, YZ_ICHUNK, f);
+        if (ferror(f)) { msg = "z_index_read: error reading file"; break; }
+        if (!zs.avail_in) { msg = "z_index_read: unexpected end of file"; break; }
+        zs.next_in = input;
+      }
+      flag = inflate(&zs, Z_NO_FLUSH);
+      before -= zs.avail_out;
+      if (offset) {
+        offset -= before;
+      } else {
+        *ldata += before;
+        want -= before;
+      }
+      if (flag != Z_OK) break;
+    }
+    if (msg || flag!=Z_OK) break;
+  }
+  if (!msg && flag!=Z_OK && flag!=Z_STREAM_END)
+    msg = (flag==Z_MEM_ERROR)? "z_index_read: out of memory in inflate" :
+      "z_index_read: compressed data corrupted, wrong index?";
+  inflateEnd(&zs);
+  p_free(discard);
+  p_free(input);
+  return msg;
+}
+
+static void
+yz_put8(Bytef *buf, long x)
+{
+  int i;
+  for (i=7 ; i>=0 ; i--, x>>=8) buf[i] = (Bytef)(x & 0xff);
+}
+
+static long
+yz_get8(Bytef *buf)
+{
+  long x = 0;
+  int i;
+  for (i=0 ; i<8 ; i++) x = (x<<8) | buf[i];
+  return x;
+}
@@ -11,8 +11,9 @@
 if (!is_void(plug_in)) plug_in, "yorz";
 
 /* NOTE:
- *  the gz stream functions are not wrapped -- for text files, you can
- *  get that functionality with the popen function and gzip program
+ *  the gz stream functions are wrapped only for binary array I/O
+ *  (gz_open) -- for text files, you can get that functionality with
+ *  the popen function and gzip program
  */
 
 extern z_deflate;
@@ -39,6 +40,8 @@ extern z_deflate;
  * to compress an arbitrary amount of DATA into ZDATA without filling
  * memory.  The NAVAIL returned by z_deflate is a lower limit on the
  * number of bytes of compressed data a subsequent z_flush will return.
+ * DATA may be larger than 4 GB (zlib itself sees it in 1 GB slices),
+ * but a DICTIONARY must be smaller than that.
  *
  * The final block of DATA must be compressed by a call to z_flush,
  * in the final form.  This flushes all remaining data into the
@@ -48,6 +51,72 @@ extern z_deflate;
  *        zdata = z_flush(z_deflate(), data)
  * Use - for DATA to indicate you have no more DATA, but want to
  * finish the compression.
+ * When yorick-z is built with libdeflate, this one-shot form (and
+ * z_deflate_batch) uses libdeflate, which is two or three times faster
+ * than zlib.  The ZDATA remains a standard zlib (or gzip or raw) stream,
+ * but is not byte-for-byte what zlib would have produced.
+ *
+ * KEYWORDS: threads=, format=, codec=, filter=, elsize=, file=, writer=,
+ *           strategy=, memlevel=, wbits=, speed=
+ *   With threads=N when the BUFFER is created, z_deflate splits its
+ *   input into 128k blocks and compresses up to N of them at a time
+ *   in parallel, each block primed with the preceding 32k of input
+ *   as a dictionary.  The result is an ordinary zlib stream, slightly
+ *   larger than without threads=, which z_inflate (or any zlib
+ *   decoder) can read.  The compressed output does not depend on N,
+ *   and N=1 is legal.  Input is held in BUFFER until a full block is
+ *   available, so NAVAIL will not increase for smaller DATA.  If
+ *   yorick-z was built without pthreads, the blocks are compressed
+ *   one at a time.
+ *   With format="gzip" when the BUFFER is created, ZDATA will have a
+ *   gzip header and trailer (as written by gzip or gz_write), and
+ *   with format="raw", ZDATA will be raw deflate data with no header
+ *   or trailer.  The default is format="zlib".  A DICTIONARY is
+ *   allowed only for zlib format.
+ *   With codec="zstd" or codec="lz4" when the BUFFER is created,
+ *   ZDATA will be a zstd or lz4 frame instead of zlib deflate data.
+ *   These are several times faster than deflate, especially lz4, at
+ *   some cost in compression.  The calling sequence is unchanged, and
+ *   z_inflate with format="auto" recognizes either.  LEVEL is a zstd
+ *   level (1-19, default 3) or lz4 level (0-12, 3 and above slower
+ *   but tighter).  For zstd, threads=N uses N zstd worker threads.
+ *   No DICTIONARY, format=, or (for lz4) threads= is allowed with
+ *   these codecs, which are available only if yorick-z was built with
+ *   libzstd or liblz4.
+ *   With filter="shuffle", "delta", "delta+shuffle", or "bitshuffle"
+ *   when the BUFFER is created, z_deflate rearranges each 64k block
+ *   of numeric DATA before compressing it: delta replaces each
+ *   element by its difference from the previous one, shuffle groups
+ *   the first bytes of all elements, then the second bytes, and so
+ *   on, and bitshuffle does the same for each bit.  For smooth or
+ *   slowly varying int, long, float, or double arrays, this often
+ *   compresses far better.  The element size is taken from the first
+ *   DATA, or elsize=N to set it explicitly.  Delta is ignored unless
+ *   N is 1, 2, 4, or 8.  ZDATA begins with a 16 byte header recording
+ *   the filter, which z_inflate with filter=1 strips, undoing the
+ *   filter, so only a yorick-z z_inflate can decompress ZDATA.
+ *   With file="name" when the BUFFER is created, ZDATA is written to
+ *   the file "name" in 1 Mbyte blocks as it is produced, rather than
+ *   accumulating in BUFFER, so that compressing any amount of DATA
+ *   takes a fixed amount of memory.  In this case, z_deflate returns
+ *   the number of bytes written so far instead of NAVAIL, and z_flush
+ *   writes all remaining output and returns the total file size in
+ *   bytes instead of ZDATA.  The final z_flush closes the file.
+ *   With writer=1 as well, a background thread does the writing, so
+ *   that compression and file output overlap (if yorick-z was built
+ *   with pthreads).
+ *   With strategy="filtered", "huffman", "rle", or "fixed", memlevel=
+ *   (1-9, default 8), or wbits= (9-15, default 15) when the BUFFER is
+ *   created, these are passed to zlib deflateInit2 (see zlib.h).
+ *   strategy="rle" is often several times faster than the default for
+ *   image-like data, with little loss of compression.  Smaller wbits=
+ *   (window size 2^wbits bytes) and memlevel= use less memory, and
+ *   wbits= is not allowed with threads=.
+ *   With speed=MBPS when the BUFFER is created, the first DATA passed
+ *   to z_deflate is used to choose LEVEL and strategy=: the first 256k
+ *   of it is compressed with a range of settings, choosing the one with
+ *   the best compression among those which run at least MBPS megabytes
+ *   per second (per thread with threads=), or the fastest if none do.
  *
  * SEE ALSO: z_inflate, z_flush, z_crc32
  */
@@ -78,6 +147,10 @@ extern z_inflate;
  * and repeat the call.  Otherwise, a return value other than 0
  * probably represents an error.  Note that z_flush will not return
  * bytes that have been written to a DATA array supplied to z_inflate.
+ * The fastest way to decompress a single block of data is:
+ *        flag = z_inflate(z_inflate(), zdata, data)
+ * With libdeflate, if the whole of ZDATA fits in DATA (or in the size=
+ * of the BUFFER), this decompresses in one pass straight into DATA.
  *
  * The FLAG returned by z_inflate is
  *   0  if the ZDATA stream is complete, in which case no
@@ -95,13 +168,69 @@ extern z_inflate;
  *      bytes after the end
  *  -2  if the ZDATA stream is corrupted
  *
- * SEE ALSO: z_deflate, z_flush, z_setdict, z_crc32
+ * KEYWORDS: size=, format=, codec=, filter=
+ *   With size=N when the BUFFER is created, z_inflate expects the
+ *   uncompressed DATA to be N bytes long.  If it is, BUFFER makes
+ *   a single N byte allocation, which z_flush returns without a copy.
+ *   A wrong N is harmless.  Without size=, BUFFER grows geometrically,
+ *   guessing the size of each chunk of output from the compression
+ *   ratio observed in previous z_inflate calls.
+ *   With format="gzip" or format="raw" when the BUFFER is created,
+ *   z_inflate expects ZDATA in gzip or raw deflate format instead of
+ *   zlib format, and with format="auto", z_inflate decides based on
+ *   the first two bytes of ZDATA.  A gzip stream may consist of
+ *   several concatenated members; z_inflate continues from one to the
+ *   next.  If the ZDATA passed to z_inflate ends with a gzip member,
+ *   the returned FLAG is 0, but BUFFER remains open, so you may pass
+ *   a subsequent member to z_inflate.
+ *   With codec="zstd" or codec="lz4", z_inflate expects a zstd or lz4
+ *   frame, see z_deflate.  Without codec=, z_inflate recognizes either
+ *   frame from the first four bytes of the first ZDATA, unless format=
+ *   is "gzip" or "raw", so codec= is rarely needed.
+ *
+ *   With filter=1 when the BUFFER is created, ZDATA must have been
+ *   compressed with a z_deflate filter=, and z_inflate undoes the
+ *   filter.  Uncompressed data then becomes available only in 64k
+ *   blocks, and output for a DATA array passed to z_inflate is staged
+ *   in BUFFER before being copied.  Without filter=1, the output is
+ *   returned exactly as compressed, filter header and all.
+ *
+ * SEE ALSO: z_deflate, z_flush, z_setdict, z_crc32, z_target
+ */
+
+extern z_target;
+/* DOCUMENT z_target, buffer, data
+ *       or z_target, buffer, [&data1, &data2, ...]
+ *       or nbytes = z_target(buffer)
+ *       or z_target, buffer, []
+ *
+ * Set an output cursor for the z_inflate BUFFER, so that subsequent
+ * z_inflate(buffer, zdata) calls decompress straight into DATA (or
+ * into DATA1, then DATA2, and so on), picking up where the previous
+ * call left off.  Output moves on to the next array as each fills,
+ * and to the internal BUFFER only when all are full.  For example,
+ * to decompress a stream of records into x(,,,1), x(,,,2), ...:
+ *   b = z_inflate();
+ *   z_target, b, x;
+ *   while (z_inflate(b, next_chunk_of_zdata()) > 0);
+ * Nothing is copied, except for any output beyond the end of the
+ * targets, which z_flush returns as usual.  BUFFER holds a reference
+ * to each target array.  A DATA argument to z_inflate takes precedence
+ * over the targets for that call, and does not move the cursor.
+ *
+ * NBYTES is the total number of bytes written to the targets so far.
+ * z_target, buffer, [] drops the targets.  Setting targets requires
+ * that BUFFER hold no output waiting for z_flush.  Targets cannot be
+ * used with a z_inflate filter=1 BUFFER.
+ *
+ * SEE ALSO: z_inflate, z_flush
  */
 
 extern z_flush;
 /* DOCUMENT zdata_or_data = z_flush(buffer)
  *       or zdata = z_flush(buffer, data)
  *       or zdata = z_flush(buffer, -)
+ *       or zdata = z_flush(buffer, sync=1)
  *       or data = z_flush(buffer, type)
  *
  * Flushes all available ZDATA (if STATE is a z_deflate state) or
@@ -111,6 +240,19 @@ extern z_flush;
  * an array data TYPE so that the return DATA value will have that
  * data type instead of char.
  *
+ * KEYWORDS: sync=
+ *   For z_deflate states, sync=1 (zlib Z_SYNC_FLUSH) or sync=2
+ *   (Z_FULL_FLUSH) compresses DATA, if given, then flushes all pending
+ *   compressed output to a byte boundary, but leaves the stream open
+ *   for further z_deflate calls.  The returned ZDATA is then enough
+ *   for z_inflate on the other end of a pipe or socket to recover all
+ *   of the data so far.  sync=2 also discards the compression history,
+ *   so that decompression can restart at that point (format="raw"),
+ *   at some cost in compression.  Each flush adds a few bytes.  For
+ *   codec="zstd" or "lz4", sync=2 is the same as sync=1.  With filter=,
+ *   input waiting to complete a 64k filter block is not flushed.  With
+ *   file=, everything is written to the file, which stays open.
+ *
  * SEE ALSO: z_deflate, z_inflate, z_setdict
  */
 
@@ -144,5 +286,228 @@ extern z_crc32;
  * a series of chunks, feeding the result of each call as input
  * to the following call.
  *
+ * KEYWORDS: threads=
+ *   Large DATA (8 MB or more) is split into one piece per thread,
+ *   the pieces checksummed in parallel, and the results combined.
+ *   By default, z_crc32 uses one thread per processor; threads=1
+ *   forces a single thread.  The result does not depend on the
+ *   number of threads.
+ *
  * SEE ALSO: z_setdict
  */
+
+extern z_deflate_batch;
+/* DOCUMENT zlist = z_deflate_batch(list)
+ *       or list = z_inflate_batch(zlist)
+ *
+ * Compress each array in the pointer array LIST separately, returning
+ * a pointer array ZLIST of the same dimensions, where ZLIST(i) is
+ * z_flush(z_deflate(), *LIST(i)).  z_inflate_batch reverses this,
+ * returning a pointer array of 1D char arrays.  Nil elements of LIST
+ * or ZLIST produce nil elements of the result (as does an empty
+ * uncompressed array for z_inflate_batch).
+ *
+ * These are much faster than calling z_deflate or z_inflate in a loop
+ * when the arrays are small (a few kilobytes or less), because the
+ * zlib state is reused from one array to the next, and from one call
+ * to the next, instead of being allocated and initialized for each.
+ * Every ZLIST(i) is a complete, independent stream.  There is no
+ * dictionary support; use z_deflate to compress with a dictionary.
+ *
+ * KEYWORDS: level=, threads=, format=
+ *   level= is the compression level, as for z_deflate.  threads=N
+ *   divides the arrays among N threads (default 1).  format= is
+ *   "zlib" (default), "gzip", or "raw", as for z_deflate, and may also
+ *   be "auto" for z_inflate_batch, which then decides for each element
+ *   of ZLIST separately.  As with z_inflate, a gzip element may consist
+ *   of several concatenated members.
+ *
+ * SEE ALSO: z_deflate, z_inflate
+ */
+extern z_inflate_batch;
+
+extern z_deflate_async;
+/* DOCUMENT job = z_deflate_async(data)
+ *     then zdata = z_wait(job)
+ *       or zdata = z_wait(job, 0)
+ *
+ * Start compressing DATA in a background thread, returning a zlib_job
+ * object JOB immediately, so that you can continue working while the
+ * compression proceeds.  z_wait(JOB) waits for the job to finish and
+ * returns the compressed ZDATA, which is the same as
+ * z_flush(z_deflate(), DATA) would produce (not byte for byte with
+ * libdeflate).  z_wait(JOB, 0) returns [] (nil) if JOB has not yet
+ * finished, without waiting.  You may call z_wait more than once.
+ * Discarding JOB waits for it to finish.
+ *
+ * By default, JOB holds a reference to DATA rather than a copy, so you
+ * must not change DATA in place (as in DATA(..)=...) until z_wait
+ * returns.  Assigning a new value to the variable is always safe.
+ *
+ * KEYWORDS: level=, format=, copy=
+ *   level= and format= are as for z_deflate_batch.  copy=1 compresses
+ *   a snapshot of DATA, so that DATA can be modified at once.
+ *   Without threads in this build, z_deflate_async finishes the job
+ *   before it returns.
+ *
+ * SEE ALSO: z_deflate, z_deflate_batch
+ */
+extern z_wait;
+
+extern z_stats;
+/* DOCUMENT stats = z_stats()
+ *       or z_stats, 0
+ *   also buffer.total_in, buffer.total_out, buffer.ratio,
+ *        buffer.cpu_seconds, buffer.chunks, buffer.bytes_buffered
+ *
+ * Return a 5-by-2 array of statistics summed over all z_deflate and
+ * z_inflate BUFFERs (and z_deflate_batch or z_inflate_batch items)
+ * since yorick started or since the last z_stats, 0 call, which
+ * resets them.  STATS(,1) is for compression and STATS(,2) for
+ * decompression, each [buffers, chunks, bytes_in, bytes_out,
+ * cpu_seconds].  A chunk is one z_deflate, z_inflate, or final
+ * z_flush call.  The cpu_seconds include any threads= workers.
+ *
+ * A BUFFER returned by z_deflate or z_inflate also has members with
+ * its own statistics:
+ *   buffer.total_in        bytes passed to z_deflate or z_inflate
+ *   buffer.total_out       bytes produced, whether flushed or not
+ *   buffer.ratio           uncompressed over compressed bytes
+ *   buffer.cpu_seconds     time spent compressing or decompressing
+ *   buffer.chunks          number of calls which did so
+ *   buffer.bytes_buffered  bytes held waiting for z_flush or input
+ * Printing a BUFFER also shows these.  For example, to find whether
+ * compression limits the speed of writing a file:
+ *   b = z_deflate(6, file="dump.z");
+ *   for (i=1 ; i<=n ; i++) z_deflate, b, get_data(i);
+ *   z_flush, b, -;
+ *   write, b.total_in/1.e6/b.cpu_seconds, b.ratio;
+ *
+ * SEE ALSO: z_deflate, z_inflate
+ */
+
+extern z_dict_train;
+/* DOCUMENT dictionary = z_dict_train(samples)
+ *
+ * Build a DICTIONARY for z_deflate from SAMPLES, a pointer array of
+ * typical arrays (nil elements are skipped).  This helps most when
+ * each of many small arrays (a few kilobytes or less) is compressed
+ * separately, since deflate has nothing to find repeated in a short
+ * array by itself.  For example:
+ *   dict = z_dict_train(records(1:1000));
+ *   zrec = z_flush(z_deflate(9, dict), *records(i));
+ *   b = z_inflate();
+ *   if (z_inflate(b, zrec) == 3) z_setdict, b, dict;
+ *   flag = z_inflate(b, zrec);
+ *   rec = z_flush(b);
+ * The DICTIONARY consists of the k byte segments of the SAMPLES which
+ * contain the most substrings common to many of the SAMPLES, as in
+ * the zstd "cover" trainer.  If all the SAMPLES together fit in the
+ * DICTIONARY, it is simply their concatenation.
+ *
+ * KEYWORDS: size=, k=, d=
+ *   size= is the maximum DICTIONARY size, default (and maximum) 32768.
+ *   k= is the segment length.  By default, z_dict_train tries k=64,
+ *   128, 256, and 512, keeping the DICTIONARY which best compresses
+ *   every fifth sample.  d=6 is the length of substrings counted.
+ *
+ * SEE ALSO: z_deflate, z_setdict, z_deflate_batch
+ */
+
+extern z_pool;
+/* DOCUMENT [held, limit] = z_pool()
+ *       or z_pool, limit
+ *
+ * zlib needs over 256k of internal state for each z_deflate buffer
+ * (about 40k for z_inflate).  Rather than returning this memory to the
+ * system when a buffer is discarded, yorick-z keeps it for the next
+ * buffer, so that creating and discarding many short-lived buffers
+ * does not repeatedly allocate and free it.  The first form returns
+ * the number of bytes currently HELD for reuse and the LIMIT on that
+ * number, which is 8 MB by default.  The second form sets LIMIT,
+ * immediately releasing any excess; z_pool, 0 releases everything
+ * and disables the pooling.  Either form of z_pool, limit also
+ * releases the zlib state kept by z_deflate_batch and z_inflate_batch
+ * workers between calls.
+ *
+ * SEE ALSO: z_deflate, z_inflate, z_deflate_batch
+ */
+
+extern gz_open;
+/* DOCUMENT f = gz_open(filename)
+ *       or f = gz_open(filename, mode)
+ *   then n = gz_read(f, data)
+ *     or gz_write, f, data
+ *     or pos = gz_seek(f, offset)
+ *     or pos = gz_seek(f, offset, 1)
+ *     or pos = gz_seek(f)
+ *     or gz_close, f
+ *
+ * Open a gzip compressed file FILENAME for binary array I/O.  MODE
+ * is "r" (the default) to read, "w" to write, or "a" to append,
+ * optionally followed by a compression level digit, as in "w9".
+ * The file is closed when the last reference to F is discarded,
+ * or explicitly by gz_close.  Writing and closing a file in "w" mode
+ * produces an ordinary .gz file readable by gunzip; reading works
+ * for .gz files and for uncompressed files.
+ *
+ * gz_read reads the bytes of the array DATA from the file, in place,
+ * returning the number of complete elements of DATA read, which will
+ * be less than numberof(DATA) at the end of the file.  gz_write writes
+ * the bytes of DATA to the file.  Neither does any format conversion,
+ * so DATA should be written and read on machines with the same
+ * primitive data formats.
+ *
+ * gz_seek sets the position in the uncompressed data to OFFSET bytes
+ * from the beginning of the file, or from the current position if
+ * the third argument is non-zero, returning the new position.  With
+ * no OFFSET, it returns the current position.  Seeking backward while
+ * reading restarts decompression at the beginning of the file, so
+ * it is slow; seeking backward while writing is an error.
+ *
+ * KEYWORDS: buffer=
+ *   gz_open uses a 256k buffer for the compressed data by default;
+ *   use buffer=N to set a different size (for gz_read and gz_write,
+ *   the uncompressed data buffers are never copied).
+ *
+ * SEE ALSO: z_deflate, z_inflate
+ */
+extern gz_read;
+extern gz_write;
+extern gz_seek;
+extern gz_close;
+
+extern z_index;
+/* DOCUMENT idx = z_index(filename)
+ *   then n = z_index_read(idx, filename, offset, data)
+ *     or z_index_save, idx, indexname
+ *     or idx = z_index_load(indexname)
+ *
+ * Build a random access index IDX for the zlib or gzip compressed
+ * file FILENAME.  z_index decompresses the whole file once, recording
+ * an access point about every 16 MB of uncompressed data.  Afterwards,
+ * z_index_read can fill the array DATA with the bytes beginning at
+ * any uncompressed OFFSET (0-origin) in FILENAME, decompressing at
+ * most the span between access points plus numberof(DATA) bytes.  Like
+ * gz_read, z_index_read returns the number of complete elements of DATA
+ * it read, which will be fewer than numberof(DATA) near the end.
+ *
+ * Each access point holds 32k of uncompressed data, so IDX uses
+ * about 2k of memory per MB of uncompressed data.  z_index_save writes
+ * IDX to the file INDEXNAME (with the 32k windows compressed), which
+ * z_index_load reads back, so you need to make the single pass over
+ * FILENAME only once.  The index is invalid if FILENAME changes.
+ *
+ * Only the first member of a gzip file with several members (as
+ * produced by concatenating .gz files) is indexed.
+ *
+ * KEYWORDS: span=
+ *   span=N records an access point about every N bytes of uncompressed
+ *   data instead of 16 MB.  Smaller N makes z_index_read faster and
+ *   IDX larger.
+ *
+ * SEE ALSO: z_inflate, gz_open
+ */
+extern z_index_read;
+extern z_index_save;
+extern z_index_load;
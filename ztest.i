@@ -30,8 +30,11 @@ func ztest(void)
       write, format="%s\n", "FAILURE: simple inflate, udat != dat";
   }
 
+  /* with libdeflate, the one-shot output may differ from zdat */
   zdat1 = z_flush(z_deflate(), dat);
-  if (sizeof(zdat1)!=sizeof(zdat) || anyof(zdat1!=zdat))
+  flag = z_inflate((b=z_inflate()), zdat1);
+  udat = z_flush(b);
+  if (flag || sizeof(udat)!=sizeof(dat) || anyof(udat!=dat(*)))
       write, format="%s\n", "FAILURE: single step deflate on flush";
 
   udat = dat;
@@ -42,6 +45,39 @@ func ztest(void)
   if (anyof(udat!=dat))
     write, format="%s\n", "FAILURE: single inflate, udat != dat";
 
+  zdatg = z_flush(z_deflate(,format="gzip"), dat);
+  zdatg = grow(zdatg, z_flush(z_deflate(9,format="gzip"), dat));
+  flag = z_inflate((b=z_inflate(format="auto")), zdatg);
+  udat = z_flush(b);
+  if (flag || sizeof(udat)!=2*sizeof(dat) || anyof(udat!=grow(dat(*),dat(*))))
+    write, format="FAILURE: two member gzip inflate, flag=%ld\n", flag;
+  /* one byte at a time, so every header is split across calls */
+  zdat2 = z_flush(z_deflate(,format="gzip"), dat(1:1000));
+  grow, zdat2, zdat2;
+  for (j=1 ; j<=2 ; j++) {
+    b = z_inflate(format=(j==1? "gzip" : "auto"));
+    udat = [];
+    for (i=1 ; i<=numberof(zdat2) ; i++) {
+      flag = z_inflate(b, zdat2(i:i));
+      if (flag < 0) break;
+      if (flag != 1) grow, udat, z_flush(b);
+    }
+    if (flag || numberof(udat)!=2000 ||
+        anyof(udat!=grow(dat(1:1000),dat(1:1000))))
+      write, format="FAILURE: gzip inflate by single bytes, flag=%ld\n", flag;
+  }
+  zdatr = z_flush(z_deflate(,format="raw"), dat);
+  flag = z_inflate((b=z_inflate(format="raw")), zdatr);
+  udat = z_flush(b);
+  if (flag || sizeof(udat)!=sizeof(dat) || anyof(udat!=dat(*)))
+    write, format="FAILURE: raw inflate, flag=%ld\n", flag;
+
+  b = z_inflate(size=sizeof(dat));
+  flag = z_inflate(b, zdat);
+  udat = z_flush(b);
+  if (flag || sizeof(udat)!=sizeof(dat) || anyof(udat!=dat(*)))
+    write, format="FAILURE: size= inflate, flag=%ld\n", flag;
+
   /* noise makes it ten times harder to compress */
   datx = dat + char(2*random(dimsof(dat)));
   zdat1 = z_flush(z_deflate(), datx);
@@ -55,7 +91,9 @@ func ztest(void)
     }
   }
   grow, zdat2, z_flush(b, datx(,i:i+100));
-  if (sizeof(zdat2)!=sizeof(zdat1) || anyof(zdat2!=zdat1))
+  flag = z_inflate((b=z_inflate()), zdat2);
+  udat = z_flush(b);
+  if (flag || sizeof(udat)!=sizeof(datx) || anyof(udat!=datx(*)))
       write, format="%s\n", "FAILURE: multiple deflate";
 
   b = z_inflate();
@@ -129,6 +167,260 @@ func ztest(void)
   if (sizeof(udat2)!=sizeof(datl) || anyof(udat2!=datl))
     write, format="%s\n", "FAILURE: long inflate, udat2 != datl";
 
+  /* block-parallel deflate does not depend on number of threads */
+  datp = grow(datx, datx, datx, datx);
+  zdatp = z_flush(z_deflate(, threads=4), datp);
+  b = z_deflate(, threads=1);
+  zdat2 = [];
+  for (i=1 ; i<=4 ; i++) {
+    z_deflate, b, datx(,1:353);
+    grow, zdat2, z_flush(b);
+    z_deflate, b, datx(,354:0);
+    grow, zdat2, z_flush(b);
+  }
+  grow, zdat2, z_flush(b, -);
+  write, format="OK: threads=4 size=%ld (default size=%ld)\n",
+    sizeof(zdatp), 4*sizeof(zdat1);
+  if (sizeof(zdat2)!=sizeof(zdatp) || anyof(zdat2!=zdatp))
+    write, format="%s\n", "FAILURE: threads=4 and threads=1 differ";
+  udat2 = datp;
+  udat2(..) = 0;
+  flag = z_inflate(z_inflate(), zdatp, udat2);
+  if (flag || anyof(udat2!=datp))
+    write, format="FAILURE: threads=4 inflate, flag=%ld\n", flag;
+
+  /* parallel checksums match chained serial checksums */
+  datc = array(datp, 32);
+  for (j=0 ; j<=1 ; j++) {
+    ck1 = z_crc32(, datc, j, threads=4);
+    ck2 = [];
+    for (i=1 ; i<=32 ; i++) ck2 = z_crc32(ck2, datc(,i), j, threads=1);
+    if (ck1 != ck2)
+      write, format="FAILURE: threads=4 z_crc32 (adler=%ld) mismatch\n", j;
+  }
+
+  /* zstd and lz4 codecs, if built in */
+  for (i=1 ; i<=2 ; i++) {
+    codec = ["zstd", "lz4"](i);
+    zdatc = ztest_codec(codec, datp);
+    if (is_void(zdatc)) {
+      write, format="OK: codec=\"%s\" not built in\n", codec;
+      continue;
+    }
+    write, format="OK: codec=\"%s\" size=%ld\n", codec, sizeof(zdatc);
+    b = z_inflate();  /* recognizes codec from frame magic number */
+    udat2 = datp;
+    udat2(..) = 0;
+    n = sizeof(zdatc) / 2;
+    flag = z_inflate(b, zdatc(1:n), udat2);
+    flag = z_inflate(b, zdatc(n+1:0));
+    udat = z_flush(b);
+    n = sizeof(udat2) - sizeof(udat);
+    udat2 = (n > 0)? grow(udat2(*)(1:n), udat) : udat;
+    if (flag || sizeof(udat2)!=sizeof(datp) || anyof(udat2!=datp(*)))
+      write, format="FAILURE: codec=\"%s\" inflate, flag=%ld\n", codec, flag;
+  }
+
+  /* batched deflate matches one stream at a time */
+  list = array(pointer, 3, 40);
+  for (i=1 ; i<=numberof(list) ; i++)
+    if (i != 7) list(i) = &datx(*)(i:i+13*i);
+  zlist = z_deflate_batch(list, threads=4);
+  if (anyof(dimsof(zlist)!=dimsof(list)) || zlist(7))
+    write, format="%s\n", "FAILURE: z_deflate_batch result shape";
+  for (i=1 ; i<=numberof(list) ; i+=17) {
+    if (i == 7) continue;
+    zdat2 = z_flush(z_deflate(), *list(i));  /* libdeflate if built in */
+    if (sizeof(*zlist(i))!=sizeof(zdat2) || anyof(*zlist(i)!=zdat2))
+      write, format="FAILURE: z_deflate_batch item %ld\n", i;
+  }
+  ulist = z_inflate_batch(zlist, threads=3);
+  for (i=1 ; i<=numberof(list) ; i++) {
+    if (i == 7) continue;
+    if (sizeof(*ulist(i))!=sizeof(*list(i)) || anyof(*ulist(i)!=*list(i)))
+      write, format="FAILURE: z_inflate_batch item %ld\n", i;
+  }
+  zlist = z_deflate_batch(list, level=9, format="gzip");
+  ulist = z_inflate_batch(zlist, format="auto");
+  if (anyof(*ulist(40)!=*list(40)))
+    write, format="%s\n", "FAILURE: z_inflate_batch format=\"auto\"";
+  zlist = [&grow(*zlist(40), *zlist(39))];
+  ulist = z_inflate_batch(zlist, format="gzip");
+  if (anyof(*ulist(1)!=grow(*list(40), *list(39))))
+    write, format="%s\n", "FAILURE: z_inflate_batch two member gzip";
+
+  /* per-buffer and global statistics */
+  z_stats, 0;
+  b = z_deflate();
+  z_deflate, b, datx;
+  zdat2 = z_flush(b, datl);
+  n = sizeof(datx) + sizeof(datl);
+  if (b.total_in!=n || b.total_out!=sizeof(zdat2) || b.chunks!=2 ||
+      b.bytes_buffered || abs(b.ratio*sizeof(zdat2)-n)>1.e-6*n ||
+      b.cpu_seconds<0.)
+    write, format="%s\n", "FAILURE: z_deflate buffer statistics";
+  b = z_inflate();
+  udat = array(char, 1000);
+  flag = z_inflate(b, zdat2, udat);
+  if (b.total_in!=sizeof(zdat2) || b.total_out!=n ||
+      b.bytes_buffered!=n-1000)
+    write, format="%s\n", "FAILURE: z_inflate buffer statistics";
+  stats = z_stats();
+  if (anyof(dimsof(stats)!=[2,5,2]) ||
+      anyof(stats(1:4,1)!=[1,2,n,sizeof(zdat2)]) ||
+      anyof(stats(1:4,2)!=[1,1,sizeof(zdat2),n]))
+    write, format="%s\n", "FAILURE: z_stats totals";
+
+  /* one-shot inflate with exact, short, and size= output */
+  for (i=1 ; i<=3 ; i++) {
+    udat = array(char, sizeof(dat) - (i==2));
+    if (i < 3) {
+      b = z_inflate();
+      flag = z_inflate(b, zdat, udat);
+      if (i == 2) grow, udat, z_flush(b);
+    } else {
+      b = z_inflate(size=sizeof(dat));
+      flag = z_inflate(b, zdat);
+      udat = z_flush(b);
+    }
+    if (flag || sizeof(udat)!=sizeof(dat) || anyof(udat!=dat(*)))
+      write, format="FAILURE: one-shot inflate case %ld, flag=%ld\n", i, flag;
+  }
+
+  /* z_deflate_async, polled and then waited for */
+  for (i=1 ; i<=2 ; i++) {
+    job = z_deflate_async(dat, copy=(i==2), format=(i==2? "gzip" : "zlib"));
+    zdat2 = z_wait(job, 0);
+    if (is_void(zdat2)) zdat2 = z_wait(job);
+    b = z_inflate(format="auto");
+    flag = z_inflate(b, zdat2);
+    if (flag || anyof(z_flush(b)!=dat(*)) || anyof(z_wait(job)!=zdat2))
+      write, format="FAILURE: z_deflate_async case %ld, flag=%ld\n", i, flag;
+  }
+
+  /* z_flush sync= makes everything so far decodable mid-stream */
+  for (i=1 ; i<=2 ; i++) {
+    b = (i==1)? z_deflate() : z_deflate(threads=2);
+    zdat2 = z_flush(b, dat(,1:404), sync=i);
+    c = z_inflate();
+    flag = z_inflate(c, zdat2);
+    udat = z_flush(c);
+    if (flag!=2 || sizeof(udat)!=sizeof(dat(,1:404)) ||
+        anyof(udat!=dat(,1:404)(*)))
+      write, format="FAILURE: z_flush sync=%ld partial, flag=%ld\n", i, flag;
+    zdat2 = z_flush(b, dat(,405:0));
+    flag = z_inflate(c, zdat2);
+    udat = z_flush(c);
+    if (flag || sizeof(udat)!=sizeof(dat(,405:0)) ||
+        anyof(udat!=dat(,405:0)(*)))
+      write, format="FAILURE: z_flush sync=%ld final, flag=%ld\n", i, flag;
+  }
+
+  /* z_target scatters output into one array, then a list of arrays */
+  for (i=1 ; i<=2 ; i++) {
+    b = z_inflate();
+    if (i == 1) {
+      udat = array(char, dimsof(dat));
+      z_target, b, udat;
+    } else {
+      u1 = array(char, 10000);
+      u2 = array(char, sizeof(dat)-10500);
+      z_target, b, [&u1, &u2];
+    }
+    for (j=1 ; j<=sizeof(zdat) ; j+=1000)
+      flag = z_inflate(b, zdat(j:min(j+999,sizeof(zdat))));
+    if (i == 2) udat = grow(u1, u2, z_flush(b));
+    if (flag || z_target(b)!=sizeof(dat)-500*(i==2) ||
+        sizeof(udat)!=sizeof(dat) || anyof(udat(*)!=dat(*)))
+      write, format="FAILURE: z_target case %ld, flag=%ld\n", i, flag;
+  }
+
+  /* strategy=, memlevel=, wbits=, and speed= produce valid streams */
+  for (i=1 ; i<=4 ; i++) {
+    if (i == 1) b = z_deflate(strategy="rle");
+    else if (i == 2) b = z_deflate(9, strategy="filtered", memlevel=9);
+    else if (i == 3) b = z_deflate(1, wbits=10, format="gzip");
+    else b = z_deflate(speed=1.e6);
+    z_deflate, b, datx;
+    zdat2 = z_flush(b, -);
+    b = z_inflate(format="auto");
+    if (z_inflate(b, zdat2) || anyof(z_flush(b)!=datx(*)))
+      write, format="FAILURE: deflate strategy/speed case %ld\n", i;
+  }
+
+  /* trained dictionary helps compress small records separately */
+  recs = array(pointer, 200);
+  for (i=1 ; i<=200 ; i++)
+    recs(i) = &strchar(swrite(format="{\"event\":%ld,\"energy\":%.4f,"+
+                              "\"detector\":\"north-%ld\",\"flags\":%ld}",
+                              i, datl(i%numberof(datl)+1)*1.7, i%7, i%3));
+  dict = z_dict_train(recs, size=4096);
+  if (structof(dict)!=char || !numberof(dict) || numberof(dict)>4096)
+    write, format="%s\n", "FAILURE: z_dict_train result";
+  n1 = n2 = 0;
+  for (i=1 ; i<=200 ; i+=10) {
+    n1 += sizeof(z_flush(z_deflate(), *recs(i)));
+    zrec = z_flush(z_deflate(, dict), *recs(i));
+    n2 += sizeof(zrec);
+    b = z_inflate();
+    if (z_inflate(b, zrec) == 3) z_setdict, b, dict;
+    if (z_inflate(b, zrec) || anyof(z_flush(b)!=*recs(i)))
+      write, format="FAILURE: z_dict_train inflate record %ld\n", i;
+  }
+  if (n2 >= n1)
+    write, format="FAILURE: z_dict_train dict %ld >= plain %ld\n", n2, n1;
+
+  /* zlib state of discarded buffers is pooled up to the limit */
+  b = [];
+  pool = z_pool();
+  if (pool(1)<=0 || pool(1)>pool(2))
+    write, format="FAILURE: z_pool held %ld, limit %ld\n", pool(1), pool(2);
+  z_pool, 0;
+  if (z_pool()(1))
+    write, format="%s\n", "FAILURE: z_pool, 0 did not release memory";
+  z_pool, pool(2);
+
+  /* shuffle and delta filters improve compression of smooth doubles */
+  datd = exp(-abs(x,y)^2);
+  zdat1 = z_flush(z_deflate(), datd);
+  for (i=1 ; i<=3 ; i++) {
+    filter = ["shuffle", "delta+shuffle", "bitshuffle"](i);
+    b = z_deflate(filter=filter);
+    n = numberof(datd) / 3;
+    z_deflate, b, datd(1:n);
+    zdat2 = z_flush(b, datd(n+1:0));
+    if (sizeof(zdat2) >= sizeof(zdat1))
+      write, format="FAILURE: filter=\"%s\" size %ld >= %ld\n",
+        filter, sizeof(zdat2), sizeof(zdat1);
+    b = z_inflate(filter=1);
+    n = sizeof(zdat2) / 2;
+    flag = z_inflate(b, zdat2(1:n));
+    udat = (flag==2)? z_flush(b, double) : [];
+    flag = z_inflate(b, zdat2(n+1:0));
+    grow, udat, z_flush(b, double);
+    if (flag || numberof(udat)!=numberof(datd) || anyof(udat!=datd(*)))
+      write, format="FAILURE: filter=\"%s\" inflate, flag=%ld\n",
+        filter, flag;
+  }
+  udat = array(0., dimsof(datd));
+  flag = z_inflate(z_inflate(filter=1), zdat2, udat);
+  if (flag || anyof(udat!=datd))
+    write, format="FAILURE: filter inflate to data, flag=%ld\n", flag;
+  /* without filter=1, data that happens to begin with the header
+   * comes back unchanged */
+  udat = grow(char([0x89,89,90,70,13,10,26,10,1,2,8,0,0,0,0,0]), dat(1:1000));
+  flag = z_inflate((b=z_inflate()), z_flush(z_deflate(), udat));
+  if (flag || anyof(z_flush(b)!=udat))
+    write, format="FAILURE: unfiltered data with filter header, flag=%ld\n",
+      flag;
+  /* gzip stream stays open after its member, partial block must finish */
+  zdat2 = z_flush(z_deflate(filter="shuffle", format="gzip"), datd);
+  b = z_inflate(format="gzip", filter=1);
+  flag = z_inflate(b, zdat2);
+  udat = z_flush(b, double);
+  if (flag || numberof(udat)!=numberof(datd) || anyof(udat!=datd(*)))
+    write, format="FAILURE: filter= with format=\"gzip\", flag=%ld\n", flag;
+
   dict = dat(6000:8000);
   b = z_deflate(,dict);
   adl = z_setdict(b);
@@ -178,4 +470,90 @@ func ztest(void)
   flag = z_inflate(b, zdatbad);
   if (flag != -2)
     write, format="%s\n", "FAILURE: did not detect corrupt zdata on inflate";
+
+  f = gz_open("test-z.gz", "w", buffer=65536);
+  gz_write, f, datl;
+  gz_write, f, dat;
+  gz_close, f;
+  f = gz_open("test-z.gz");
+  if (gz_seek(f, 8*sizeof(datl)) != 8*sizeof(datl))
+    write, format="%s\n", "FAILURE: gz_seek position";
+  udat = dat;
+  udat(..) = 0;
+  n = gz_read(f, udat);
+  if (n!=numberof(dat) || anyof(udat!=dat))
+    write, format="FAILURE: gz_read, n = %ld\n", n;
+  if (gz_read(f, udat))
+    write, format="%s\n", "FAILURE: gz_read past end of file";
+  gz_seek, f, 0;
+  udat2 = datl;
+  udat2(..) = 0;
+  if (gz_read(f, udat2)!=numberof(datl) || anyof(udat2!=datl))
+    write, format="%s\n", "FAILURE: gz_read after rewind";
+  gz_close, f;
+
+  f = gz_open("test-z.gz", "w");
+  gz_write, f, datc;
+  gz_close, f;
+  idx = z_index("test-z.gz", span=65536);
+  z_index_save, idx, "test-z.idx";
+  idx = z_index_load("test-z.idx");
+  for (i=1 ; i<=3 ; i++) {
+    off = [1, 1234567, sizeof(datc)-100](i);
+    udat = array(char, 1000);
+    n = z_index_read(idx, "test-z.gz", off, udat);
+    if (n!=min(1000, sizeof(datc)-off) || anyof(udat(1:n)!=datc(*)(off+1:off+n)))
+      write, format="FAILURE: z_index_read at %ld, n = %ld\n", off, n;
+  }
+
+  for (i=0 ; i<=1 ; i++) {
+    b = z_deflate(9, file="test-z.gz", writer=i, format="gzip");
+    n = sizeof(datc) / 3;
+    z_deflate, b, datc(*)(1:n);
+    z_deflate, b, datc(*)(n+1:2*n);
+    nz = z_flush(b, datc(*)(2*n+1:0));
+    f = gz_open("test-z.gz");
+    udat = array(char, dimsof(datc));
+    n = gz_read(f, udat);
+    gz_close, f;
+    if (nz<=0 || n!=sizeof(datc) || anyof(udat!=datc))
+      write, format="FAILURE: z_deflate file=, writer=%ld\n", i;
+  }
+  remove, "test-z.gz";
+  remove, "test-z.idx";
+}
+
+func ztest_codec(codec, data)
+{
+  if (catch(-1)) {
+    /* skip only codecs missing from this build */
+    if (strmatch(catch_message, "built without")) return [];
+    error, catch_message;
+  }
+  if (codec == "zstd") b = z_deflate(, codec=codec, threads=2);
+  else b = z_deflate(, codec=codec);
+  zdat = z_deflate(b, data(,1:300));
+  return z_flush(b, data(,301:0));
+}
+
+func ztest_big(void)
+/* DOCUMENT ztest_big
+     test z_deflate, z_inflate, and z_crc32 on an array larger than 4 GB,
+     which zlib must be fed in slices.  Not run by ztest, since it needs
+     about 5 GB of memory and a minute or so.
+ */
+{
+  big = array(char(indgen(0:250)), 17928288);   /* 4.5e9 bytes */
+  crc = z_crc32(, big);
+  b = z_deflate(1);
+  z_deflate, b, big;
+  zdat = z_flush(b, -);
+  big(*) = 0;
+  flag = z_inflate(z_inflate(), zdat, big);
+  if (flag)
+    write, format="FAILURE: >4 GB inflate, flag=%ld\n", flag;
+  else if (z_crc32(, big) != crc)
+    write, format="%s\n", "FAILURE: >4 GB inflate, crc32 mismatch";
+  else
+    write, format="OK: >4 GB deflate size=%ld\n", sizeof(zdat);
 }